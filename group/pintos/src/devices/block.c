@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -19,6 +21,17 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Detailed statistics, updated with interrupts off since
+       requests may complete in interrupt handlers. */
+    struct iostat_op read_stats;        /* Reads. */
+    struct iostat_op write_stats;       /* Writes. */
+    unsigned long long sequential_cnt;  /* Requests that continue the last. */
+    unsigned long long random_cnt;      /* Other requests. */
+    block_sector_t next_sector;         /* Sector after the last request. */
+    unsigned depth;                     /* Requests in progress. */
+    unsigned max_depth;                 /* Largest DEPTH. */
+    unsigned long long depth_sum;       /* Sum of DEPTH at each submit. */
   };
 
 /* List of all block devices. */
@@ -113,6 +126,18 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
+static void
+check_range (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +145,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +156,175 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multi (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer the whole run with a
+   single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR between a block device and BUFFER: from BUFFER to the
+   device if WRITE is true, from the device to BUFFER otherwise.
+   On completion, COMPLETE is called with R, whose AUX member is
+   set to AUX; if COMPLETE is null, block_wait() may be used
+   instead. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    void (*complete) (struct block_request *), void *aux)
+{
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  r->done_cnt = 0;
+  r->complete = complete;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+  r->block = NULL;
+}
+
+/* Starts request R on BLOCK and returns, usually before it has
+   completed.  Devices whose drivers have no request queue carry
+   out R before returning. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+  struct iostat_op *op;
+
+  ASSERT (r->cnt > 0);
+  check_range (block, r->sector, r->cnt);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  old_level = intr_disable ();
+  if (r->write)
+    {
+      block->write_cnt += r->cnt;
+      op = &block->write_stats;
+    }
+  else
+    {
+      block->read_cnt += r->cnt;
+      op = &block->read_stats;
+    }
+  op->requests++;
+  op->bytes += (uint64_t) r->cnt * BLOCK_SECTOR_SIZE;
+  if (r->sector == block->next_sector)
+    block->sequential_cnt++;
+  else
+    block->random_cnt++;
+  block->next_sector = r->sector + r->cnt;
+
+  /* Time the request on the device it is first submitted to. */
+  if (r->block == NULL)
+    {
+      r->block = block;
+      r->start = timer_now_ns ();
+      if (++block->depth > block->max_depth)
+        block->max_depth = block->depth;
+      block->depth_sum += block->depth;
+    }
+  intr_set_level (old_level);
+
+  r->done_cnt = 0;
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      const struct block_operations *ops = block->ops;
+      uint8_t *p = r->buffer;
+      size_t i;
+
+      if (r->write && ops->write_multi != NULL)
+        ops->write_multi (block->aux, r->sector, r->cnt, p);
+      else if (!r->write && ops->read_multi != NULL)
+        ops->read_multi (block->aux, r->sector, r->cnt, p);
+      else
+        for (i = 0; i < r->cnt; i++, p += BLOCK_SECTOR_SIZE)
+          if (r->write)
+            ops->write (block->aux, r->sector + i, p);
+          else
+            ops->read (block->aux, r->sector + i, p);
+      r->done_cnt = r->cnt;
+      block_request_done (r);
+    }
+}
+
+/* Waits for request R, which must have been initialized without
+   a completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Called by a driver when it has finished request R. */
+void
+block_request_done (struct block_request *r)
+{
+  struct block *block = r->block;
+
+  if (block != NULL)
+    {
+      uint64_t ns = timer_now_ns () - r->start;
+      struct iostat_op *op = r->write ? &block->write_stats
+                                      : &block->read_stats;
+      enum intr_level old_level;
+      int bucket;
+
+      for (bucket = 0; bucket < IOSTAT_BUCKETS - 1; bucket++)
+        if ((ns >> (bucket + 1)) == 0)
+          break;
+
+      old_level = intr_disable ();
+      op->completed++;
+      op->ns += ns;
+      op->latency[bucket]++;
+      block->depth--;
+      intr_set_level (old_level);
+    }
+
+  if (r->complete != NULL)
+    r->complete (r);
+  else
+    sema_up (&r->done);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,7 +348,46 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Copies BLOCK's statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct iostat *stats)
+{
+  enum intr_level old_level;
+
+  strlcpy (stats->name, block->name, sizeof stats->name);
+  strlcpy (stats->type, block_type_name (block->type), sizeof stats->type);
+  stats->size = (uint64_t) block->size * BLOCK_SECTOR_SIZE;
+
+  old_level = intr_disable ();
+  stats->read = block->read_stats;
+  stats->write = block->write_stats;
+  stats->sequential = block->sequential_cnt;
+  stats->random = block->random_cnt;
+  stats->depth_sum = block->depth_sum;
+  stats->max_depth = block->max_depth;
+  intr_set_level (old_level);
+}
+
+/* Prints the statistics in OP, for requests of the given KIND. */
+static void
+print_op_stats (const char *kind, const struct iostat_op *op)
+{
+  int i;
+
+  if (op->requests == 0)
+    return;
+  printf ("  %s: %"PRIu64" requests, %"PRIu64" bytes", kind,
+          op->requests, op->bytes);
+  if (op->completed > 0)
+    printf (", %"PRIu64" ns average latency", op->ns / op->completed);
+  printf ("\n");
+  for (i = 0; i < IOSTAT_BUCKETS; i++)
+    if (op->latency[i] > 0)
+      printf ("    %2d: %"PRIu64"\n", i, op->latency[i]);
+}
+
+/* Prints statistics for each block device used for a Pintos role.
+   Latency histograms are in powers of two of nanoseconds. */
 void
 block_print_stats (void)
 {
@@ -171,9 +398,27 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          struct iostat stats;
+          uint64_t requests, timed;
+
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+
+          block_get_stats (block, &stats);
+          requests = stats.sequential + stats.random;
+          timed = stats.read.completed + stats.write.completed;
+          if (requests == 0)
+            continue;
+          print_op_stats ("reads", &stats.read);
+          print_op_stats ("writes", &stats.write);
+          printf ("  %"PRIu64"%% sequential", stats.sequential * 100 / requests);
+          if (timed > 0)
+            printf (", queue depth %"PRIu64".%02"PRIu64" average, "
+                    "%"PRIu32" maximum",
+                    stats.depth_sum / timed,
+                    stats.depth_sum * 100 / timed % 100, stats.max_depth);
+          printf ("\n");
         }
     }
 }
@@ -200,6 +445,12 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (&block->read_stats, 0, sizeof block->read_stats);
+  memset (&block->write_stats, 0, sizeof block->write_stats);
+  block->sequential_cnt = block->random_cnt = 0;
+  block->next_sector = 0;
+  block->depth = block->max_depth = 0;
+  block->depth_sum = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <iostat.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +56,74 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request transfers CNT consecutive sectors between a block
+   device and BUFFER.  block_submit() returns at once; when the
+   transfer is done, the driver calls COMPLETE, or ups DONE if
+   COMPLETE is null, so that block_wait() returns.  COMPLETE may
+   be called in an interrupt handler, so it must not sleep.
+
+   Drivers may reorder and merge requests that are outstanding at
+   the same time, so a request must not be submitted while an
+   overlapping one is in progress. */
+struct block_request
+  {
+    struct list_elem elem;      /* For use by the driver. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* Write to the device? */
+    size_t done_cnt;            /* Sectors transferred so far. */
+
+    void (*complete) (struct block_request *);  /* Completion callback. */
+    void *aux;                  /* For use by COMPLETE. */
+    struct semaphore done;      /* Up'd on completion if no COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct block *block;        /* Device submitted to. */
+    int64_t start;              /* timer_now_ns() at submission. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         void (*complete) (struct block_request *),
+                         void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
+void block_get_stats (struct block *, struct iostat *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* A driver provides either SUBMIT, which queues a request and
+   must eventually call block_request_done() for it, or READ and
+   WRITE, which transfer one sector synchronously.  READ_MULTI and
+   WRITE_MULTI, if not null, transfer CNT consecutive sectors
+   synchronously in one request; otherwise the block layer issues
+   one READ or WRITE per sector. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *buffer);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *buffer);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_request_done (struct block_request *);
 
 #endif /* devices/block.h */
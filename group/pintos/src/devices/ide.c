@@ -3,15 +3,36 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Sectors are transferred with bus-master DMA when the disks sit
+   on a PCI IDE controller that supports it, such as the PIIX
+   emulated by QEMU, so that the CPU is free to run other threads
+   while the disk works.  Otherwise, or if a buffer is unsuitable
+   for DMA, sectors are moved by the CPU in PIO mode.
+
+   Block requests wait in a queue per disk, kept in order of the
+   next sector to transfer.  Whenever a channel is idle, it takes
+   the first request at or past the sector where the disk's last
+   transfer ended, wrapping around to the lowest one (C-LOOK), and
+   merges following requests in the same direction that continue
+   it into the same command.  Commands are issued by a worker
+   thread for each channel, since selecting a disk and waiting
+   for it to accept a command take busy-waiting that must not be
+   done in an interrupt handler.  The transfer is then driven by
+   the channel's interrupt handler, which wakes the worker when it
+   is done, so threads only wait for their own requests. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +55,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +71,45 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE register addresses, relative to a channel's
+   bm_base.  See the Intel PIIX datasheet. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
+
+/* A physical region descriptor, which tells the bus master to
+   transfer SIZE bytes (0 means 64 kB) at physical address ADDR.
+   A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, must be even. */
+    uint16_t size;              /* Byte count. */
+    uint16_t flags;             /* PRD_EOT for the last region. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Maximum number of requests merged into one transfer. */
+#define SEG_CNT 16
+
+/* Regions in a channel's PRD table.  Each merged request of up
+   to 128 kB touches at most three 64 kB regions. */
+#define PRD_CNT (3 * SEG_CNT)
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +118,20 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Transfer sectors with DMA? */
+    block_sector_t capacity;    /* Size in sectors, once identified. */
+    char extra_info[128];       /* Model and serial number. */
+
+    /* Accessed with interrupts off. */
+    struct list queue;          /* Waiting requests, by next sector. */
+    block_sector_t head;        /* Sector after the last transfer. */
+  };
+
+/* Part of a transfer that belongs to one request. */
+struct segment
+  {
+    struct block_request *r;    /* The request. */
+    size_t cnt;                 /* Sectors from R's next sector on. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,10 +142,27 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore probed;    /* Up'd when the devices are identified. */
+    struct semaphore kick;      /* Up'd when the worker may have work. */
+
+    uint16_t bm_base;           /* Bus master registers, 0 if no DMA. */
+    struct prd prd[PRD_CNT] __attribute__ ((aligned (512)));
+                                /* PRD table, must not cross 64 kB. */
+
+    /* Transfer in progress, if ACTIVE is non-null.  Accessed with
+       interrupts off, since the interrupt handler drives it. */
+    struct ata_disk *active;    /* Disk being accessed, or null. */
+    block_sector_t sector;      /* First sector. */
+    bool write;                 /* Writing to the disk? */
+    bool dma;                   /* Using DMA rather than PIO? */
+    struct segment segs[SEG_CNT];       /* Requests being served. */
+    size_t seg_cnt;             /* Number of SEGS in use. */
+    size_t seg_idx, seg_ofs;    /* PIO: next sector to move. */
+    size_t left;                /* PIO: sectors not yet moved. */
+    int next_dev;               /* Disk to consider first next time. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,32 +173,50 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static thread_func probe_channel;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static thread_func channel_worker NO_RETURN;
+static bool pick_transfer (struct channel *);
+static void issue_transfer (struct channel *);
+static void continue_transfer (struct channel *);
+static void finish_transfer (struct channel *);
+
+static uint16_t find_bus_master (void);
+static bool setup_dma (struct channel *);
+
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_drq (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and detect disks.
+
+   Resetting a channel and waiting for its disks to come out of
+   reset takes over 150 ms, so each channel is probed by its own
+   thread and the channels are reset at the same time.  The disks
+   are registered afterward, in a fixed order, so that block
+   devices and partitions always get the same names. */
 void
 ide_init (void)
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
+  int dev_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
-      int dev_no;
 
       /* Initialize channel. */
       snprintf (c->name, sizeof c->name, "ide%zu", chan_no);
@@ -123,9 +233,13 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      sema_init (&c->probed, 0);
+      sema_init (&c->kick, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->active = NULL;
+      c->next_dev = 0;
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,25 +250,62 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
+          list_init (&d->queue);
+          d->head = 0;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
 
-      /* Reset hardware. */
-      reset_channel (c);
+      /* Probe hardware. */
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c)
+          == TID_ERROR)
+        probe_channel (c);
+    }
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  /* Register the disks that were found. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
 
-      /* Read hard disk identity information. */
+      sema_down (&c->probed);
+      if (thread_create (c->name, PRI_MAX, channel_worker, c) == TID_ERROR)
+        PANIC ("%s: can't create worker thread", c->name);
       for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
+        {
+          struct ata_disk *d = &c->devices[dev_no];
+          if (d->is_ata)
+            partition_scan (block_register (d->name, BLOCK_RAW,
+                                            d->extra_info, d->capacity,
+                                            &ide_operations, d));
+        }
     }
 }
 
+/* Resets channel C_ and identifies the disks on it, then signals
+   ide_init() that they are ready to be registered. */
+static void
+probe_channel (void *c_)
+{
+  struct channel *c = c_;
+  int dev_no;
+
+  /* Reset hardware. */
+  reset_channel (c);
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  /* Read hard disk identity information. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    if (c->devices[dev_no].is_ata)
+      identify_ata_device (&c->devices[dev_no]);
+
+  sema_up (&c->probed);
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -254,8 +405,8 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response into D's capacity and extra_info members.  Clears
+   D's is_ata member if the disk should not be used. */
 static void
 identify_ata_device (struct ata_disk *d)
 {
@@ -263,8 +414,6 @@ identify_ata_device (struct ata_disk *d)
   char id[BLOCK_SECTOR_SIZE];
   block_sector_t capacity;
   char *model, *serial;
-  char extra_info[128];
-  struct block *block;
 
   ASSERT (d->is_ata);
 
@@ -286,9 +435,15 @@ identify_ata_device (struct ata_disk *d)
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info,
+  snprintf (d->extra_info, sizeof d->extra_info,
             "model \"%s\", serial \"%s\"", model, serial);
 
+  /* Use DMA if the controller can and the disk says it supports
+     it (word 49, bit 8). */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+  if (d->dma)
+    strlcat (d->extra_info, ", DMA", sizeof d->extra_info);
+
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
@@ -302,11 +457,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
-                          &ide_operations, d);
-  partition_scan (block);
+  d->capacity = capacity;
 }
 
 /* Translates STRING, which consists of SIZE bytes in a funky
@@ -337,63 +488,288 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Maximum number of sectors transferred by a single command.
+   A sector count of 0 in the Sector Count register means 256. */
+#define MAX_TRANSFER 256
+
+/* Returns the next sector that request R will transfer. */
+static block_sector_t
+next_sector (const struct block_request *r)
+{
+  return r->sector + r->done_cnt;
+}
+
+/* Returns true if request A transfers its next sector before
+   request B does. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request,
+                                              elem);
+  const struct block_request *b = list_entry (b_, struct block_request,
+                                              elem);
+  return next_sector (a) < next_sector (b);
+}
+
+/* Queues request R for disk D and wakes D's channel's worker if
+   the channel is idle. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_submit (void *d_, struct block_request *r)
 {
   struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  list_insert_ordered (&d->queue, &r->elem, request_less, NULL);
+  if (d->channel->active == NULL)
+    sema_up (&d->channel->kick);
+  intr_set_level (old_level);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Issues the commands for channel C_'s transfers, one at a time,
+   whenever the channel is idle and has requests queued. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+channel_worker (void *c_)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      bool picked;
+
+      sema_down (&c->kick);
+      old_level = intr_disable ();
+      picked = c->active == NULL && pick_transfer (c);
+      intr_set_level (old_level);
+      if (picked)
+        issue_transfer (c);
+    }
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_submit
   };
 
+/* Returns the address of the next sector to move in PIO mode on
+   channel C. */
+static uint8_t *
+pio_sector (struct channel *c)
+{
+  struct segment *seg = &c->segs[c->seg_idx];
+  uint8_t *buffer = seg->r->buffer;
+  return buffer + (seg->r->done_cnt + c->seg_ofs) * BLOCK_SECTOR_SIZE;
+}
+
+/* Advances channel C past the sector just moved in PIO mode. */
+static void
+pio_advance (struct channel *c)
+{
+  if (++c->seg_ofs == c->segs[c->seg_idx].cnt)
+    {
+      c->seg_idx++;
+      c->seg_ofs = 0;
+    }
+  c->left--;
+}
+
+/* Chooses a transfer for the next queued request on idle channel
+   C, merging into it the requests that follow it on disk, if
+   there are any, and makes it C's active transfer.  Returns false
+   if there are no requests.  Called with interrupts off. */
+static bool
+pick_transfer (struct channel *c)
+{
+  struct ata_disk *d = NULL;
+  struct list_elem *e;
+  size_t cnt;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->active == NULL);
+
+  /* Alternate between the disks on C while both have work. */
+  for (i = 0; i < 2; i++)
+    {
+      struct ata_disk *t = &c->devices[(c->next_dev + i) % 2];
+      if (!list_empty (&t->queue))
+        {
+          d = t;
+          break;
+        }
+    }
+  if (d == NULL)
+    return false;
+  c->next_dev = !d->dev_no;
+
+  /* C-LOOK: the first request at or past the head, or else the
+     lowest one. */
+  for (e = list_begin (&d->queue); e != list_end (&d->queue);
+       e = list_next (e))
+    if (next_sector (list_entry (e, struct block_request, elem)) >= d->head)
+      break;
+  if (e == list_end (&d->queue))
+    e = list_begin (&d->queue);
+
+  /* Take that request and any that continue it. */
+  c->sector = next_sector (list_entry (e, struct block_request, elem));
+  c->write = list_entry (e, struct block_request, elem)->write;
+  c->seg_cnt = 0;
+  cnt = 0;
+  while (e != list_end (&d->queue) && c->seg_cnt < SEG_CNT
+         && cnt < MAX_TRANSFER)
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      size_t seg_cnt = r->cnt - r->done_cnt;
+
+      if (c->seg_cnt > 0
+          && (next_sector (r) != c->sector + cnt || r->write != c->write
+              || seg_cnt > MAX_TRANSFER - cnt))
+        break;
+      if (seg_cnt > MAX_TRANSFER)
+        seg_cnt = MAX_TRANSFER;
+      c->segs[c->seg_cnt].r = r;
+      c->segs[c->seg_cnt].cnt = seg_cnt;
+      c->seg_cnt++;
+      cnt += seg_cnt;
+      e = list_remove (e);
+    }
+  d->head = c->sector + cnt;
+
+  c->active = d;
+  c->seg_idx = c->seg_ofs = 0;
+  c->left = cnt;
+  return true;
+}
+
+/* Programs the disk, and the bus master if DMA can be used, for
+   the transfer that pick_transfer() chose on channel C, and
+   issues the command.  Busy-waits for the disk to be ready, so it
+   is called by C's worker with interrupts on. */
+static void
+issue_transfer (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  c->dma = d->dma && setup_dma (c);
+  select_sector (d, c->sector, c->left);
+  if (c->dma)
+    {
+      outb (reg_command (c), c->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), (c->write ? 0 : BM_CMD_READ) | BM_CMD_START);
+    }
+  else
+    {
+      outb (reg_command (c),
+            c->write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+
+      /* The first sector of a write goes out without waiting for
+         an interrupt.  The disk interrupts once it has taken the
+         sector, which must not be handled before we advance. */
+      if (c->write)
+        {
+          if (!wait_for_drq (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, c->sector);
+          old_level = intr_disable ();
+          output_sector (c, pio_sector (c));
+          pio_advance (c);
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Handles an interrupt for the transfer in progress on channel
+   C.  With DMA, the disk interrupts once at the end.  In PIO
+   mode, it interrupts when each sector is ready to be read, or
+   when each sector written has been accepted. */
+static void
+continue_transfer (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  uint8_t status = inb (reg_status (c));      /* Acknowledge interrupt. */
+
+  if (c->dma)
+    {
+      uint8_t bm_status;
+
+      outb (reg_bm_command (c), c->write ? 0 : BM_CMD_READ);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+      if ((bm_status & BM_STA_ERR) != 0
+          || (status & (STA_BSY | STA_ERR)) != 0)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, c->write ? "write" : "read", c->sector);
+      c->left = 0;
+    }
+  else if (c->left > 0)
+    {
+      if ((status & (STA_BSY | STA_ERR | STA_DRQ)) != STA_DRQ)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, c->write ? "write" : "read", c->sector);
+      if (c->write)
+        output_sector (c, pio_sector (c));
+      else
+        input_sector (c, pio_sector (c));
+      pio_advance (c);
+
+      /* A write is done only when the last sector is accepted. */
+      if (c->write || c->left > 0)
+        return;
+    }
+  else if ((status & STA_ERR) != 0)
+    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, c->sector);
+
+  finish_transfer (c);
+}
+
+/* Completes the requests, or the parts of them, moved by the
+   transfer on channel C, which has just finished, and wakes C's
+   worker to start the next transfer.  Called with interrupts
+   off. */
+static void
+finish_transfer (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  size_t i;
+
+  for (i = 0; i < c->seg_cnt; i++)
+    {
+      struct block_request *r = c->segs[i].r;
+
+      r->done_cnt += c->segs[i].cnt;
+      if (r->done_cnt < r->cnt)
+        list_insert_ordered (&d->queue, &r->elem, request_less, NULL);
+      else
+        block_request_done (r);
+    }
+  c->active = NULL;
+  sema_up (&c->kick);
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between
+   1 and MAX_TRANSFER, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_TRANSFER);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_TRANSFER ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -430,6 +806,120 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Reads the 32-bit register at offset REG in the PCI configuration
+   space of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that drives the two
+   legacy channels and is capable of bus mastering.  If one is
+   found, enables bus mastering and returns the I/O port base of
+   its bus master registers.  Otherwise, returns 0. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage (01), IDE (01), legacy ports on both
+           channels (bits 0 and 2 clear), bus master (bit 7). */
+        class = pci_read_config (dev, func, 0x08) >> 8;
+        if ((class >> 8) != 0x0101 || (class & 0x85) != 0x80)
+          continue;
+
+        /* BAR 4 holds the bus master registers in I/O space. */
+        bar = pci_read_config (dev, func, 0x20);
+        if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus master access in the Command
+           register.  Writing zeros to the Status register in the
+           upper half leaves it unchanged. */
+        pci_write_config (dev, func, 0x04,
+                          (pci_read_config (dev, func, 0x04) & 0xffff)
+                          | 0x05);
+        return bar & 0xfffc;
+      }
+  return 0;
+}
+
+/* Prepares channel C's bus master for the transfer described by
+   C's segments.  Returns false, leaving the bus master alone, if
+   any of the segments' buffers cannot be used for DMA. */
+static bool
+setup_dma (struct channel *c)
+{
+  size_t i, n = 0;
+
+  for (i = 0; i < c->seg_cnt; i++)
+    {
+      struct segment *seg = &c->segs[i];
+      uint8_t *buffer = seg->r->buffer;
+      void *p = buffer + seg->r->done_cnt * BLOCK_SECTOR_SIZE;
+
+      /* Kernel virtual addresses map physical memory linearly, so
+         a kernel buffer is physically contiguous. */
+      if (!is_kernel_vaddr (p) || ((uintptr_t) p & 1) != 0)
+        return false;
+    }
+
+  /* Describe the buffers as regions that don't cross 64 kB. */
+  for (i = 0; i < c->seg_cnt; i++)
+    {
+      struct segment *seg = &c->segs[i];
+      uint8_t *buffer = seg->r->buffer;
+      uintptr_t addr = vtop (buffer + seg->r->done_cnt * BLOCK_SECTOR_SIZE);
+      size_t left = seg->cnt * BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          size_t size = 0x10000 - (addr & 0xffff);
+          if (size > left)
+            size = left;
+
+          ASSERT (n < PRD_CNT);
+          c->prd[n].addr = addr;
+          c->prd[n].size = size & 0xffff;
+          c->prd[n].flags = 0;
+          n++;
+          addr += size;
+          left -= size;
+        }
+    }
+  c->prd[n - 1].flags = PRD_EOT;
+
+  /* Point the bus master at the table and clear any stale error
+     or interrupt.  The transfer starts once the disk has its
+     command. */
+  outl (reg_bm_prdt (c), vtop (c->prd));
+  outb (reg_bm_command (c), c->write ? 0 : BM_CMD_READ);
+  outb (reg_bm_status (c), inb (reg_bm_status (c))
+                           | BM_STA_ERR | BM_STA_INTR);
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -446,7 +936,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +969,25 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Busy-waits up to 100 ms for disk D to clear BSY, and then
+   returns the status of the DRQ bit.  Unlike wait_while_busy(),
+   which sleeps 10 ms at a time, it notices at once. */
+static bool
+wait_for_drq (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +998,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +1020,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt)
+        if (c->active != NULL)
+          continue_transfer (c);
+        else if (c->expecting_interrupt)
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
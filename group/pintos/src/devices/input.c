@@ -41,6 +41,25 @@ input_getc (void)
   return key;
 }
 
+/* Reads up to SIZE bytes from the input buffer into BUF and
+   returns the number of bytes read.  If the buffer is empty,
+   waits for a key to be pressed, then takes everything that is
+   available at once, without returning to the caller between
+   bytes. */
+size_t
+input_read (void *buf, size_t size)
+{
+  enum intr_level old_level;
+  size_t cnt;
+
+  old_level = intr_disable ();
+  cnt = intq_read (&buffer, buf, size);
+  serial_notify ();
+  intr_set_level (old_level);
+
+  return cnt;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -74,6 +74,36 @@ intq_putc (struct intq *q, uint8_t byte)
   signal (q, &q->not_empty);
 }
 
+/* Removes up to SIZE bytes from Q into BUFFER and returns the
+   number of bytes removed.  If Q is empty, sleeps until a byte
+   is added, so the return value is nonzero unless SIZE is 0.
+   Must not be called from an interrupt handler. */
+size_t
+intq_read (struct intq *q, void *buffer_, size_t size)
+{
+  uint8_t *buffer = buffer_;
+  size_t cnt;
+
+  ASSERT (!intr_context ());
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (size == 0)
+    return 0;
+  while (intq_empty (q))
+    {
+      lock_acquire (&q->lock);
+      wait (q, &q->not_empty);
+      lock_release (&q->lock);
+    }
+
+  for (cnt = 0; cnt < size && !intq_empty (q); cnt++)
+    {
+      buffer[cnt] = q->buf[q->tail];
+      q->tail = next (q->tail);
+    }
+  signal (q, &q->not_full);
+  return cnt;
+}
+
 /* Returns the position after POS within an intq. */
 static int
 next (int pos)
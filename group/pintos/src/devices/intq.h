@@ -1,6 +1,7 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <stddef.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
@@ -18,7 +19,7 @@
    handlers. */
 
 /* Queue buffer size, in bytes. */
-#define INTQ_BUFSIZE 64
+#define INTQ_BUFSIZE 4096
 
 /* A circular queue of bytes. */
 struct intq
@@ -39,5 +40,6 @@ bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_read (struct intq *, void *, size_t);
 
 #endif /* devices/intq.h */
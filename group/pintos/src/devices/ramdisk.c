@@ -0,0 +1,170 @@
+#include "devices/ramdisk.h"
+#include <ctype.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory, named "ram0".  Its size is set
+   with the "-ramdisk" kernel command-line option, and it may be
+   given any role, e.g. with "-filesys=ram0".  Accesses are plain
+   memory copies, so file system code can be measured without
+   disk latency.  The contents are lost at shutdown unless they
+   are copied elsewhere.
+
+   The disk is made of individual pages, taken from the kernel
+   pool while it lasts and then from the user pool, so it need
+   not be physically contiguous. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static block_sector_t ram_sectors;      /* Size of the RAM disk. */
+static uint8_t **ram_pages;             /* Pages of the RAM disk. */
+static struct block *ram_block;         /* The RAM disk, once created. */
+
+static struct block_operations ramdisk_operations;
+
+/* Sets the size of the RAM disk from SIZE, a number of bytes
+   optionally followed by K, M or G.  Returns false if SIZE is not
+   a valid size. */
+bool
+ramdisk_configure (const char *size)
+{
+  unsigned long long bytes = 0;
+  const char *p;
+
+  if (size == NULL || !isdigit (*size))
+    return false;
+  for (p = size; isdigit (*p); p++)
+    bytes = bytes * 10 + (*p - '0');
+  switch (toupper (*p))
+    {
+    case 'G':
+      bytes *= 1024;
+      /* Fall through. */
+    case 'M':
+      bytes *= 1024;
+      /* Fall through. */
+    case 'K':
+      bytes *= 1024;
+      p++;
+      break;
+    }
+  if (*p != '\0' || bytes / BLOCK_SECTOR_SIZE > 0xffffffffULL)
+    return false;
+
+  ram_sectors = bytes / BLOCK_SECTOR_SIZE;
+  return true;
+}
+
+/* Creates the RAM disk and registers it, if a size was
+   configured. */
+void
+ramdisk_init (void)
+{
+  size_t page_cnt, i;
+  char extra_info[32];
+
+  if (ram_sectors == 0)
+    return;
+
+  page_cnt = DIV_ROUND_UP (ram_sectors, SECTORS_PER_PAGE);
+  ram_pages = malloc (page_cnt * sizeof *ram_pages);
+  if (ram_pages == NULL)
+    PANIC ("ram0: can't allocate page table for %'zu pages", page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    {
+      ram_pages[i] = palloc_get_page (PAL_ZERO);
+      if (ram_pages[i] == NULL)
+        ram_pages[i] = palloc_get_page (PAL_ZERO | PAL_USER);
+      if (ram_pages[i] == NULL)
+        PANIC ("ram0: out of memory after %'zu of %'zu pages", i, page_cnt);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "%zu pages of RAM", page_cnt);
+  ram_block = block_register ("ram0", BLOCK_RAW, extra_info, ram_sectors,
+                              &ramdisk_operations, NULL);
+}
+
+/* Copies the contents of block device SRC into the RAM disk, as
+   much of it as fits. */
+void
+ramdisk_load (struct block *src)
+{
+  block_sector_t cnt, sector;
+
+  if (ram_block == NULL || src == NULL || src == ram_block)
+    return;
+
+  cnt = block_size (src);
+  if (cnt > ram_sectors)
+    cnt = ram_sectors;
+  for (sector = 0; sector < cnt; sector += SECTORS_PER_PAGE)
+    {
+      block_sector_t left = cnt - sector;
+      block_read_multi (src, sector,
+                        left < SECTORS_PER_PAGE ? left : SECTORS_PER_PAGE,
+                        ram_pages[sector / SECTORS_PER_PAGE]);
+    }
+  printf ("ram0: loaded %'"PRDSNu" sectors from %s\n",
+          cnt, block_name (src));
+}
+
+/* Returns the address of SECTOR within the RAM disk. */
+static uint8_t *
+sector_addr (block_sector_t sector)
+{
+  return (ram_pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Copies CNT sectors starting at SECTOR into BUFFER. */
+static void
+ramdisk_read_multi (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                    void *buffer)
+{
+  uint8_t *p = buffer;
+
+  for (; cnt > 0; cnt--, sector++, p += BLOCK_SECTOR_SIZE)
+    memcpy (p, sector_addr (sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Copies CNT sectors from BUFFER into the RAM disk starting at
+   SECTOR. */
+static void
+ramdisk_write_multi (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                     const void *buffer)
+{
+  const uint8_t *p = buffer;
+
+  for (; cnt > 0; cnt--, sector++, p += BLOCK_SECTOR_SIZE)
+    memcpy (sector_addr (sector), p, BLOCK_SECTOR_SIZE);
+}
+
+/* Copies SECTOR into BUFFER. */
+static void
+ramdisk_read (void *aux, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multi (aux, sector, 1, buffer);
+}
+
+/* Copies BUFFER into SECTOR. */
+static void
+ramdisk_write (void *aux, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multi (aux, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multi,
+    ramdisk_write_multi,
+    NULL
+  };
@@ -0,0 +1,12 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stdbool.h>
+
+struct block;
+
+bool ramdisk_configure (const char *size);
+void ramdisk_init (void);
+void ramdisk_load (struct block *);
+
+#endif /* devices/ramdisk.h */
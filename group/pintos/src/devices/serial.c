@@ -1,7 +1,8 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <list.h>
+#include <string.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -33,6 +34,10 @@
 #define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear receive and transmit FIFOs. */
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
@@ -48,14 +53,29 @@
 #define LSR_DR 0x01             /* Data Ready: received data byte is in RBR. */
 #define LSR_THRE 0x20           /* THR Empty. */
 
+/* Size of the 16550A's transmit FIFO, in bytes.  Once THR Empty
+   is set, this many bytes may be written without waiting. */
+#define TX_FIFO_SIZE 16
+
+/* Transmit buffer size, in bytes.  Must be a power of 2. */
+#define TX_BUFSIZE 16384
+
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
+/* Data to be transmitted, as a circular buffer.  Bytes
+   TX_TAIL...TX_HEAD - 1 (mod TX_BUFSIZE) are waiting.  The indexes
+   only increase, so their difference is the number of bytes
+   queued.  Accessed with interrupts off. */
+static uint8_t tx_buf[TX_BUFSIZE];
+static unsigned tx_head, tx_tail;
+
+/* Threads waiting for room in TX_BUF. */
+static struct list tx_waiters = LIST_INITIALIZER (tx_waiters);
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static void fill_fifo (void);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -68,10 +88,9 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);       /* Enable FIFOs. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
   mode = POLL;
 }
 
@@ -98,31 +117,70 @@ serial_init_queue (void)
 void
 serial_putc (uint8_t byte)
 {
+  serial_write (&byte, 1);
+}
+
+/* Sends the N bytes in BUFFER to the serial port.  Once
+   interrupts are set up, the bytes are copied into the transmit
+   buffer and the interrupt handler feeds them to the UART a FIFO
+   at a time.  If the buffer is full, waits for room, or sends
+   bytes by polling if interrupts are off. */
+void
+serial_write (const void *buffer, size_t n)
+{
+  const uint8_t *p = buffer;
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte);
+      while (n-- > 0)
+        putc_poll (*p++);
     }
   else
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq))
+      while (n > 0)
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq));
+          unsigned space = TX_BUFSIZE - (tx_head - tx_tail);
+          unsigned ofs = tx_head % TX_BUFSIZE;
+          size_t chunk;
+
+          if (space == 0)
+            {
+              if (old_level == INTR_ON && !intr_context ())
+                {
+                  /* Wait for the interrupt handler to make room. */
+                  write_ier ();
+                  list_push_back (&tx_waiters, &thread_current ()->elem);
+                  thread_block ();
+                }
+              else
+                {
+                  /* Interrupts are off and the transmit buffer is
+                     full.  If we wanted to wait for the buffer to
+                     empty, we'd have to reenable interrupts.
+                     That's impolite, so we'll send a FIFO's worth
+                     via polling instead. */
+                  while ((inb (LSR_REG) & LSR_THRE) == 0)
+                    continue;
+                  fill_fifo ();
+                }
+              continue;
+            }
+
+          chunk = n;
+          if (chunk > space)
+            chunk = space;
+          if (chunk > TX_BUFSIZE - ofs)
+            chunk = TX_BUFSIZE - ofs;
+          memcpy (tx_buf + ofs, p, chunk);
+          tx_head += chunk;
+          p += chunk;
+          n -= chunk;
         }
-
-      intq_putc (&txq, byte);
       write_ier ();
     }
 
@@ -135,8 +193,8 @@ void
 serial_flush (void)
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  while (tx_head != tx_tail)
+    putc_poll (tx_buf[tx_tail++ % TX_BUFSIZE]);
   intr_set_level (old_level);
 }
 
@@ -182,7 +240,7 @@ write_ier (void)
 
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (tx_head != tx_tail)
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
@@ -205,6 +263,23 @@ putc_poll (uint8_t byte)
   outb (THR_REG, byte);
 }
 
+/* Moves up to a FIFO's worth of bytes from the transmit buffer
+   to the UART, whose transmit FIFO must be empty, and wakes any
+   threads waiting for room in the buffer. */
+static void
+fill_fifo (void)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < TX_FIFO_SIZE && tx_head != tx_tail; i++)
+    outb (THR_REG, tx_buf[tx_tail++ % TX_BUFSIZE]);
+  while (!list_empty (&tx_waiters))
+    thread_unblock (list_entry (list_pop_front (&tx_waiters),
+                                struct thread, elem));
+}
+
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED)
@@ -218,10 +293,9 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
-    outb (THR_REG, intq_getc (&txq));
+  /* If the transmit FIFO has drained, refill it. */
+  if (tx_head != tx_tail && (inb (LSR_REG) & LSR_THRE) != 0)
+    fill_fifo ();
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
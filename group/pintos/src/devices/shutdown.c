@@ -8,10 +8,13 @@
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/log.h"
 #endif
 
 /* Keyboard control register port. */
@@ -57,6 +60,7 @@ void
 shutdown_reboot (void)
 {
   printf ("Rebooting...\n");
+  console_flush ();
 
     /* See [kbd] for details on how to program the keyboard
      * controller. */
@@ -97,6 +101,7 @@ shutdown_power_off (void)
   print_stats ();
 
   printf ("Powering off...\n");
+  console_flush ();
   serial_flush ();
 
   /* ACPI power-off */
@@ -125,10 +130,13 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  log_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  pagedir_print_stats ();
 #endif
 }
@@ -24,11 +24,27 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter frequency in Hz, or 0 if the CPU has no
+   time-stamp counter or it has not been calibrated yet.
+   Initialized by timer_calibrate(). */
+static uint64_t tsc_hz;
+
+/* Time-stamp counter value at TSC_BASE_NS nanoseconds after the
+   OS booted, the starting point for timer_now_ns(). */
+static uint64_t tsc_base;
+static int64_t tsc_base_ns;
+
+/* Number of timer ticks over which the time-stamp counter is
+   calibrated. */
+#define TSC_CALIBRATION_TICKS (TIMER_FREQ / 10)
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static bool cpu_has_tsc (void);
+static uint64_t rdtsc (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -39,11 +55,14 @@ timer_init (void)
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and the time-stamp counter, used by timer_now_ns(). */
 void
 timer_calibrate (void)
 {
   unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t tsc;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -63,7 +82,44 @@ timer_calibrate (void)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  printf ("%'"PRIu64" loops/s", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Count time-stamp counter cycles from one timer tick to
+     another TSC_CALIBRATION_TICKS later. */
+  if (cpu_has_tsc ())
+    {
+      start = timer_ticks ();
+      while (timer_ticks () == start)
+        continue;
+      start++;
+      tsc = rdtsc ();
+      while (timer_ticks () < start + TSC_CALIBRATION_TICKS)
+        continue;
+      tsc_base_ns = start * (1000000000 / TIMER_FREQ);
+      tsc_base = tsc;
+      tsc_hz = (rdtsc () - tsc) * TIMER_FREQ / TSC_CALIBRATION_TICKS;
+      printf (", %'"PRIu64" TSC cycles/s", tsc_hz);
+    }
+  printf (".\n");
+}
+
+/* Returns the number of nanoseconds since the OS booted.  The
+   value never decreases.  Once timer_calibrate() has run, it has
+   the resolution of the CPU's time-stamp counter, if there is one;
+   otherwise it only advances once per timer tick. */
+int64_t
+timer_now_ns (void)
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (1000000000 / TIMER_FREQ);
+
+  /* Split the conversion so that the multiplication cannot
+     overflow. */
+  cycles = rdtsc () - tsc_base;
+  return (tsc_base_ns + cycles / tsc_hz * 1000000000
+          + cycles % tsc_hz * 1000000000 / tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -169,10 +225,10 @@ timer_print_stats (void)
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
   ticks++;
-  thread_tick ();
+  thread_tick ((args->cs & 3) == 3);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -245,3 +301,26 @@ real_time_delay (int64_t num, int32_t denom)
   ASSERT (denom % 1000 == 0);
   busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
 }
+
+/* Returns true if the CPU has a time-stamp counter, according to
+   the TSC feature flag reported by CPUID.  See [IA32-v2a]
+   "CPUID". */
+static bool
+cpu_has_tsc (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1 << 4)) != 0;
+}
+
+/* Returns the CPU's time-stamp counter, which counts cycles.
+   See [IA32-v2b] "RDTSC". */
+static uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
@@ -0,0 +1,68 @@
+/* iostat.c
+
+   Prints I/O statistics for each block device: requests and bytes
+   transferred in each direction, latency histograms, the share of
+   sequential requests and the average queue depth. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_op (const char *kind, const struct iostat_op *);
+
+int
+main (void)
+{
+  struct iostat stats;
+  int dev;
+
+  for (dev = 0; iostat (dev, &stats); dev++)
+    {
+      uint64_t requests = stats.sequential + stats.random;
+      uint64_t timed = stats.read.completed + stats.write.completed;
+
+      printf ("%s (%s), %"PRIu64" bytes\n", stats.name, stats.type,
+              stats.size);
+      if (requests == 0)
+        continue;
+      print_op ("read", &stats.read);
+      print_op ("write", &stats.write);
+      printf ("  %"PRIu64" sequential, %"PRIu64" random",
+              stats.sequential, stats.random);
+      if (timed > 0)
+        printf (", queue depth %"PRIu64".%02"PRIu64" average, "
+                "%"PRIu32" maximum",
+                stats.depth_sum / timed, stats.depth_sum * 100 / timed % 100,
+                stats.max_depth);
+      printf ("\n");
+    }
+  return EXIT_SUCCESS;
+}
+
+/* Prints the statistics in OP for requests of the given KIND,
+   with a bar for each bucket of the latency histogram. */
+static void
+print_op (const char *kind, const struct iostat_op *op)
+{
+  uint64_t max = 0;
+  int i;
+
+  printf ("  %s: %"PRIu64" requests, %"PRIu64" bytes\n",
+          kind, op->requests, op->bytes);
+  if (op->completed == 0)
+    return;
+  printf ("  %s latency: %"PRIu64" ns average\n",
+          kind, op->ns / op->completed);
+  for (i = 0; i < IOSTAT_BUCKETS; i++)
+    if (op->latency[i] > max)
+      max = op->latency[i];
+  for (i = 0; i < IOSTAT_BUCKETS; i++)
+    if (op->latency[i] > 0)
+      {
+        int bar = op->latency[i] * 50 / max;
+        printf ("    2^%-2d %10"PRIu64" ", i, op->latency[i]);
+        while (bar-- > 0)
+          putchar ('*');
+        putchar ('\n');
+      }
+}
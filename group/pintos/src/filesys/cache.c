@@ -0,0 +1,515 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.  Keeps recently used sectors of the file system
+   device in memory, so that repeated reads of directories and
+   inodes are served without going to disk and small writes to
+   the same sector are coalesced.
+
+   Dirty sectors are written back when they are evicted, by a
+   background thread every FLUSH_INTERVAL ticks, and by
+   cache_flush() when the file system shuts down.  Sectors written
+   with cache_write_logged() are the exception: they stay in the
+   cache until the log (see log.c) has committed them and called
+   cache_install().
+
+   cache_lock protects the mapping from sectors to entries and
+   each entry's bookkeeping.  Each entry's data is protected by
+   its own readers-writer lock, which is only taken while the
+   entry is pinned, so that a pinned entry is never chosen for
+   eviction. */
+
+/* How often the flush thread writes back dirty sectors. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Maximum number of read-ahead requests waiting to be served.
+   More requests than this are dropped. */
+#define READ_AHEAD_QUEUE 64
+
+/* Maximum number of sectors the read-ahead thread reads with a
+   single disk request.  It also never holds more than a quarter
+   of the cache's entries at once. */
+#define READ_AHEAD_RUN 32
+
+/* A cached sector. */
+struct cache_entry
+  {
+    /* Protected by cache_lock. */
+    block_sector_t sector;      /* Sector held, if IN_USE. */
+    bool in_use;                /* Holds a sector? */
+    bool accessed;              /* Used since the clock hand passed? */
+    unsigned pin_cnt;           /* Number of threads using this entry. */
+    bool logged;                /* Waiting for log commit?  Changed only
+                                   while RWLOCK is also held for writing. */
+
+    /* Protected by RWLOCK. */
+    struct rwlock rwlock;       /* Readers-writer lock on the data. */
+    bool dirty;                 /* Modified since read from disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];  /* Sector contents. */
+  };
+
+size_t cache_size = CACHE_DEFAULT_SIZE;
+
+static struct cache_entry *cache;     /* Array of CACHE_SIZE entries. */
+static struct lock cache_lock;        /* Protects mapping, pins, clock. */
+static struct condition cache_unpinned;  /* Signaled on last unpin. */
+static size_t clock_hand;             /* Next entry to consider evicting. */
+
+/* A run of consecutive sectors to read ahead. */
+struct ra_request
+  {
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
+/* Runs waiting to be read ahead, as a circular queue. */
+static struct ra_request ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head, ra_cnt;        /* First request, number queued. */
+static struct lock ra_lock;           /* Protects the queue. */
+static struct condition ra_nonempty;  /* Signaled when a request arrives. */
+static uint8_t *ra_buffer;            /* READ_AHEAD_RUN sectors. */
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, writeback_cnt, prefetch_cnt;
+
+static void write_sector (block_sector_t, const void *, off_t ofs,
+                          off_t size, bool logged);
+static struct cache_entry *cache_get (block_sector_t, bool exclusive,
+                                      bool need_data);
+static void cache_put (struct cache_entry *, bool exclusive);
+static struct cache_entry *claim (block_sector_t);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *choose_victim (void);
+static thread_func flush_daemon NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+static size_t read_run (block_sector_t, size_t cnt);
+
+/* Initializes the buffer cache and starts its flush and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  if (cache_size == 0)
+    cache_size = 1;
+  cache = calloc (cache_size, sizeof *cache);
+  if (cache == NULL)
+    PANIC ("can't allocate %zu-sector buffer cache", cache_size);
+  for (i = 0; i < cache_size; i++)
+    rwlock_init (&cache[i].rwlock);
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  ra_buffer = malloc (READ_AHEAD_RUN * BLOCK_SECTOR_SIZE);
+  if (ra_buffer == NULL)
+    PANIC ("can't allocate read-ahead buffer");
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e, false);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS.  The sector is only read from disk first if the write
+   does not cover all of it.  The write reaches the disk later,
+   when the sector is evicted or flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, off_t ofs,
+             off_t size)
+{
+  write_sector (sector, buffer, ofs, size, false);
+}
+
+/* Like cache_write(), but for a sector that belongs to the
+   current log transaction.  The sector is kept in the cache,
+   not written back, until cache_install() is called for it. */
+void
+cache_write_logged (block_sector_t sector, const void *buffer, off_t ofs,
+                    off_t size)
+{
+  write_sector (sector, buffer, ofs, size, true);
+}
+
+/* Writes SECTOR, which has been committed to the log, to its
+   place on disk and lets it be evicted again. */
+void
+cache_install (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, true, true);
+
+  if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      writeback_cnt++;
+    }
+  lock_acquire (&cache_lock);
+  e->logged = false;
+  lock_release (&cache_lock);
+  cache_put (e, true);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS, marking it as waiting for the log if LOGGED is true. */
+static void
+write_sector (block_sector_t sector, const void *buffer, off_t ofs,
+              off_t size, bool logged)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, ofs > 0 || size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  if (logged && !e->logged)
+    {
+      lock_acquire (&cache_lock);
+      e->logged = true;
+      lock_release (&cache_lock);
+    }
+  cache_put (e, true);
+}
+
+/* Asks the read-ahead thread to bring the CNT consecutive
+   sectors starting at SECTOR into the cache, and returns without
+   waiting for them.  The request is dropped if the queue is
+   full. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE)
+    {
+      struct ra_request *r = &ra_queue[(ra_head + ra_cnt++)
+                                       % READ_AHEAD_QUEUE];
+      r->sector = sector;
+      r->cnt = cnt;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Writes every dirty sector in the cache to disk, except those
+   waiting for the log to commit them. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->in_use)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      /* Writers hold the lock exclusively, so a read lock is
+         enough to keep DIRTY, LOGGED and DATA stable. */
+      rwlock_read_acquire (&e->rwlock);
+      if (e->dirty && !e->logged)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          writeback_cnt++;
+        }
+      cache_put (e, false);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld writebacks, "
+          "%lld sectors read ahead\n",
+          hit_cnt, miss_cnt, writeback_cnt, prefetch_cnt);
+}
+
+/* Returns the entry holding SECTOR, pinned and locked for
+   writing if EXCLUSIVE is true or for reading otherwise.  If
+   SECTOR is not cached, evicts another sector to make room and
+   reads SECTOR from disk, unless NEED_DATA is false, in which
+   case the caller must overwrite the entire sector. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool exclusive, bool need_data)
+{
+  struct cache_entry *e;
+
+  ASSERT (need_data || exclusive);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        break;
+
+      /* claim() fails if another thread brought SECTOR in while
+         it was writing back a victim.  Look again. */
+      e = claim (sector);
+      if (e != NULL)
+        {
+          miss_cnt++;
+          lock_release (&cache_lock);
+
+          if (need_data)
+            block_read (fs_device, sector, e->data);
+          if (!exclusive)
+            {
+              rwlock_write_release (&e->rwlock);
+              rwlock_read_acquire (&e->rwlock);
+            }
+          return e;
+        }
+    }
+
+  e->pin_cnt++;
+  e->accessed = true;
+  hit_cnt++;
+  lock_release (&cache_lock);
+
+  if (exclusive)
+    rwlock_write_acquire (&e->rwlock);
+  else
+    rwlock_read_acquire (&e->rwlock);
+  return e;
+}
+
+/* Unlocks and unpins entry E, obtained from cache_get() with the
+   same EXCLUSIVE argument. */
+static void
+cache_put (struct cache_entry *e, bool exclusive)
+{
+  if (exclusive)
+    rwlock_write_release (&e->rwlock);
+  else
+    rwlock_read_release (&e->rwlock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0 && !e->logged)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Evicts a sector to make room for SECTOR, which is not cached,
+   and returns the entry, pinned and locked for writing but not
+   yet filled.  The caller must hold cache_lock.
+
+   A dirty victim is written back with cache_lock released, so
+   that other sectors can be found meanwhile.  The victim is
+   pinned and still holds its old sector during the write, so
+   threads that want that sector find it in the cache instead of
+   reading stale data from disk.  If one of them is still using
+   it afterward, or if another thread has brought SECTOR into the
+   cache in the meantime, the victim is left alone.  In the
+   latter case, returns a null pointer. */
+static struct cache_entry *
+claim (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      e = choose_victim ();
+      ASSERT (!e->logged);
+      if (!e->in_use || !e->dirty)
+        break;
+
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      /* As in cache_flush(), a read lock keeps DIRTY and DATA
+         stable. */
+      rwlock_read_acquire (&e->rwlock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          writeback_cnt++;
+        }
+      rwlock_read_release (&e->rwlock);
+
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0 && !e->logged)
+        cond_signal (&cache_unpinned, &cache_lock);
+      if (lookup (sector) != NULL)
+        return NULL;
+
+      /* Nobody holds an unpinned entry's lock, so DIRTY is
+         stable. */
+      if (e->pin_cnt == 0 && !e->logged && !e->dirty)
+        break;
+    }
+
+  e->sector = sector;
+  e->in_use = true;
+  e->accessed = true;
+  e->pin_cnt = 1;
+  e->dirty = false;
+
+  /* Nobody else holds the unpinned victim's lock, so this does
+     not block.  Threads that want SECTOR from now on find this
+     entry and wait on its lock until it has been filled. */
+  rwlock_write_acquire (&e->rwlock);
+  return e;
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  The caller must hold cache_lock. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < cache_size; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry that is neither pinned nor waiting for the
+   log to reuse, with the clock algorithm, waiting for an entry to
+   be released if necessary.  The caller must hold cache_lock. */
+static struct cache_entry *
+choose_victim (void)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      size_t pinned = 0;
+      size_t i;
+
+      /* Two trips around the clock are enough to find an entry
+         unless every entry is pinned or logged. */
+      for (i = 0; i < 2 * cache_size; i++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % cache_size;
+
+          if (e->pin_cnt > 0 || e->logged)
+            pinned++;
+          else if (!e->in_use || !e->accessed)
+            return e;
+          else
+            e->accessed = false;
+        }
+      if (pinned == 2 * cache_size)
+        cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Writes back dirty sectors every FLUSH_INTERVAL ticks, so that
+   a crash loses at most that much work. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Serves read-ahead requests queued by cache_prefetch(),
+   reading each run of sectors that is not already cached into the
+   cache with as few disk requests as possible.  Runs in its own
+   thread so that the disk reads overlap with whatever the
+   requesting thread does with the data it already has. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct ra_request r;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      r = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      while (r.cnt > 0)
+        {
+          size_t done = read_run (r.sector, r.cnt);
+          r.sector += done;
+          r.cnt -= done;
+        }
+    }
+}
+
+/* Reads as many of the CNT sectors starting at SECTOR as are not
+   cached and consecutive into the cache with one disk request.
+   Returns the number of sectors dealt with, counting a leading
+   sector that is already cached, which is skipped. */
+static size_t
+read_run (block_sector_t sector, size_t cnt)
+{
+  struct cache_entry *run[READ_AHEAD_RUN];
+  size_t max = cache_size / 4;
+  size_t n, i;
+
+  if (max > READ_AHEAD_RUN)
+    max = READ_AHEAD_RUN;
+  if (max < 1)
+    max = 1;
+
+  /* Claim an entry for each sector, stopping at the first one
+     that is already cached. */
+  lock_acquire (&cache_lock);
+  for (n = 0; n < cnt && n < max; n++)
+    {
+      if (lookup (sector + n) != NULL)
+        break;
+      run[n] = claim (sector + n);
+      if (run[n] == NULL)
+        break;
+    }
+  lock_release (&cache_lock);
+  if (n == 0)
+    return 1;
+
+  block_read_multi (fs_device, sector, n, ra_buffer);
+  for (i = 0; i < n; i++)
+    {
+      memcpy (run[i]->data, ra_buffer + i * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+      cache_put (run[i], true);
+    }
+  prefetch_cnt += n;
+  return n;
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Default number of sectors in the buffer cache. */
+#define CACHE_DEFAULT_SIZE 64
+
+/* Number of sectors in the buffer cache.
+   Controlled by kernel command-line option "-cache". */
+extern size_t cache_size;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, off_t ofs, off_t size);
+void cache_write (block_sector_t, const void *buffer, off_t ofs, off_t size);
+void cache_write_logged (block_sector_t, const void *buffer, off_t ofs,
+                         off_t size);
+void cache_install (block_sector_t);
+void cache_prefetch (block_sector_t, size_t cnt);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
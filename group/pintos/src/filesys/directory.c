@@ -1,16 +1,21 @@
 #include "filesys/directory.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current position, if linear. */
+    uint64_t hash_pos;                  /* Current position, if indexed */
+    char name_pos[NAME_MAX + 1];        /*   (see next_indexed()). */
   };
 
 /* A single directory entry. */
@@ -21,12 +26,247 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A small directory is just an array of entries, which is
+   searched from start to end.  Once it needs more than
+   LINEAR_MAX entries, it is converted to an indexed directory,
+   in which the first sector holds a header and each following
+   sector is a bucket of BUCKET_ENTRIES entries.  A name always
+   goes in the bucket selected by the low bits of its hash (see
+   bucket_for()), so looking it up reads one bucket.
+
+   When that bucket is full, the directory grows by linear
+   hashing: one bucket at a time is split, in order, by moving
+   the entries that belong in a new bucket at the end.  Each
+   split writes the new bucket, then the header, then the old
+   bucket.  An entry only counts if it is in the bucket its name
+   selects, so the directory is consistent after each of those
+   writes, even if a crash leaves only some of them on disk. */
+#define BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+#define LINEAR_MAX BUCKET_ENTRIES
+#define INITIAL_BUCKETS 4               /* Buckets when converted. */
+#define MAX_BUCKETS 4096                /* Limit on splitting. */
+
+/* Identifies an indexed directory. */
+#define DIR_MAGIC 0x44495258
+
+/* Header of an indexed directory, which occupies the slot of the
+   first entry of a linear directory.  It cannot be mistaken for
+   one: an entry that is not in use has either never been used,
+   so that it is all zeros, or has a name. */
+struct dir_header
+  {
+    unsigned magic;                     /* DIR_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    uint8_t unused[NAME_MAX + 1 - sizeof (uint32_t)];
+    bool in_use;                        /* Always false. */
+  };
+
+/* Byte offset of bucket IDX in an indexed directory. */
+static inline off_t
+bucket_ofs (size_t idx)
+{
+  return (idx + 1) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the mask that selects the bucket for HASH among
+   BUCKETS buckets.  With N the largest power of 2 not above
+   BUCKETS, buckets below BUCKETS - N and from N up have been
+   split and use one more bit of the hash than the others. */
+static size_t
+bucket_mask (unsigned hash, size_t buckets)
+{
+  size_t n = 1;
+
+  while (n * 2 <= buckets)
+    n *= 2;
+  return (hash & (2 * n - 1)) < buckets ? 2 * n - 1 : n - 1;
+}
+
+/* Returns the bucket for HASH among BUCKETS buckets. */
+static size_t
+bucket_for (unsigned hash, size_t buckets)
+{
+  return hash & bucket_mask (hash, buckets);
+}
+
+/* Returns true if E, found in bucket IDX of a directory with
+   BUCKETS buckets, or anywhere in a linear directory if BUCKETS
+   is 0, is in use.  An entry left behind in the bucket it was
+   split from is not. */
+static bool
+entry_in_use (const struct dir_entry *e, size_t buckets, size_t idx)
+{
+  return (e->in_use
+          && (buckets == 0
+              || bucket_for (hash_string (e->name), buckets) == idx));
+}
+/* Dentry cache.
+
+   Remembers the results of recent lookups, so that resolving a
+   long path does not read every directory along the way.  Each
+   entry maps a directory's inode sector and a name to the inode
+   sector the name refers to, or to 0 if the directory has no
+   entry by that name ("negative" entry).  Entries are replaced
+   in least-recently-used order.
+
+   Entries for a directory are only looked up, filled in or
+   changed while holding that directory's lock (see inode_lock()),
+   which also serializes changes to the directory itself, so the
+   cache never disagrees with the disk.  dcache_lock protects the
+   cache's own data structures and is never held across I/O. */
+#define DCACHE_SIZE 64
+
+struct dentry
+  {
+    block_sector_t parent;              /* Directory, or 0 if unused. */
+    char name[NAME_MAX + 1];            /* Name within PARENT. */
+    block_sector_t child;               /* NAME's inode, or 0 if none. */
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+  };
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache;              /* Entries in use. */
+static struct list dcache_lru;          /* All entries, most recent first. */
+static struct lock dcache_lock;
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  lock_init (&dcache_lock);
+  if (!hash_init (&dcache, dentry_hash, dentry_less, NULL))
+    PANIC ("can't create dentry cache");
+  list_init (&dcache_lru);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&dcache_lru, &dentries[i].lru_elem);
+}
+
+/* Returns the cached entry for NAME in directory PARENT, or a
+   null pointer if there is none.  The caller must hold
+   dcache_lock. */
+static struct dentry *
+dcache_find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+  struct dentry *d;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  if (e == NULL)
+    return NULL;
+
+  d = hash_entry (e, struct dentry, hash_elem);
+  list_remove (&d->lru_elem);
+  list_push_front (&dcache_lru, &d->lru_elem);
+  return d;
+}
+
+/* Looks up NAME in directory PARENT in the cache.  If it is
+   there, stores the inode sector it refers to, or 0 if PARENT
+   has no such name, into *CHILD and returns true.  Otherwise,
+   returns false. */
+static bool
+dcache_get (block_sector_t parent, const char *name, block_sector_t *child)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    *child = d->child;
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory PARENT refers to CHILD, or that
+   there is no such name if CHILD is 0. */
+static void
+dcache_set (block_sector_t parent, const char *name, block_sector_t child)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d == NULL)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_back (&dcache_lru), struct dentry, lru_elem);
+      if (d->parent != 0)
+        hash_delete (&dcache, &d->hash_elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+    }
+  d->child = child;
+  lock_release (&dcache_lock);
+}
+
+/* Drops every cached entry within directory PARENT, which is
+   being deleted, so that none can be found if its sector is
+   reused for another directory. */
+static void
+dcache_purge (block_sector_t parent)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    if (dentries[i].parent == parent)
+      {
+        hash_delete (&dcache, &dentries[i].hash_elem);
+        dentries[i].parent = 0;
+        list_remove (&dentries[i].lru_elem);
+        list_push_back (&dcache_lru, &dentries[i].lru_elem);
+      }
+  lock_release (&dcache_lock);
+}
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose ".." entry refers to PARENT.  Returns true
+   if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  ASSERT (sizeof (struct dir_header) == sizeof (struct dir_entry));
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+  dir = dir_open (inode_open (sector));
+  success = dir != NULL && dir_add (dir, "..", parent);
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,6 +323,41 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the number of buckets in DIR if it is indexed, or 0
+   if it is linear. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  struct dir_header h;
+
+  if (inode_read_at (dir->inode, &h, sizeof h, 0) == sizeof h
+      && h.magic == DIR_MAGIC && !h.in_use)
+    return h.bucket_cnt;
+  return 0;
+}
+
+/* Sets *START and *END to the range of byte offsets in DIR that
+   holds the entry for NAME, if there is one, and where a new
+   entry for NAME may be put.  For a linear directory, END is the
+   end of the file. */
+static void
+search_range (const struct dir *dir, const char *name,
+              off_t *start, off_t *end)
+{
+  size_t buckets = bucket_cnt (dir);
+
+  if (buckets == 0)
+    {
+      *start = 0;
+      *end = inode_length (dir->inode);
+    }
+  else
+    {
+      *start = bucket_ofs (bucket_for (hash_string (name), buckets));
+      *end = *start + BUCKET_ENTRIES * sizeof (struct dir_entry);
+    }
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -93,14 +368,16 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs, end;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
+  search_range (dir, name, &ofs, &end);
+  for (; ofs < end; ofs += sizeof e)
+    if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+      break;
+    else if (e.in_use && !strcmp (name, e.name))
       {
         if (ep != NULL)
           *ep = e;
@@ -111,23 +388,185 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Returns the offset of the first free entry at or after START
+   and before END in DIR.  Returns END if there is none.
+   inode_read_at() will only return a short read at end of file,
+   which counts as free space.  Otherwise, we'd need to verify
+   that we didn't get a short read due to something intermittent
+   such as low memory. */
+static off_t
+find_free (const struct dir *dir, off_t start, off_t end)
+{
+  struct dir_entry e;
+  size_t buckets = bucket_cnt (dir);
+  size_t idx = buckets != 0 ? start / BLOCK_SECTOR_SIZE - 1 : 0;
+  off_t ofs;
+
+  for (ofs = start; ofs < end; ofs += sizeof e)
+    if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+        || !entry_in_use (&e, buckets, idx))
+      break;
+  return ofs;
+}
+
+/* Writes BUCKET_CNT to DIR's header.  Returns true if
+   successful, false on failure. */
+static bool
+write_header (struct dir *dir, size_t bucket_cnt)
+{
+  struct dir_header h;
+
+  memset (&h, 0, sizeof h);
+  h.magic = DIR_MAGIC;
+  h.bucket_cnt = bucket_cnt;
+  h.in_use = false;
+  return inode_write_at (dir->inode, &h, sizeof h, 0) == sizeof h;
+}
+
+/* Adds a bucket to indexed directory DIR, which has BUCKETS
+   buckets, by splitting the next bucket in turn: each of its
+   entries that belongs in new bucket BUCKETS moves to the same
+   slot there.  Returns true if successful, false on failure. */
+static bool
+split_bucket (struct dir *dir, size_t buckets)
+{
+  const size_t size = BUCKET_ENTRIES * sizeof (struct dir_entry);
+  struct dir_entry *old = malloc (size);
+  struct dir_entry *new = malloc (size);
+  size_t victim, n, j;
+  bool success;
+
+  /* With N the largest power of 2 not above BUCKETS, buckets
+     0...BUCKETS - N - 1 have already been split. */
+  for (n = 1; n * 2 <= buckets; n *= 2)
+    continue;
+  victim = buckets - n;
+
+  success = (old != NULL && new != NULL
+             && inode_read_at (dir->inode, old, size,
+                               bucket_ofs (victim)) == size);
+  if (success)
+    {
+      memset (new, 0, size);
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (old[j].in_use)
+          {
+            size_t idx = bucket_for (hash_string (old[j].name),
+                                     buckets + 1);
+            if (idx == buckets)
+              new[j] = old[j];
+            if (idx != victim)
+              old[j].in_use = false;
+          }
+    }
+
+  /* Until the header is written, the new bucket is ignored; after
+     it is, the moved entries left in the old bucket are. */
+  success = (success
+             && inode_write_at (dir->inode, new, size,
+                                bucket_ofs (buckets)) == size
+             && write_header (dir, buckets + 1)
+             && inode_write_at (dir->inode, old, size,
+                                bucket_ofs (victim)) == size);
+
+  free (old);
+  free (new);
+  return success;
+}
+
+/* Adds an entry for NAME and INODE_SECTOR to indexed directory
+   DIR, splitting buckets as needed to make room.  Returns true
+   if successful, false on failure. */
+static bool
+add_indexed (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  struct dir_entry e;
+
+  for (;;)
+    {
+      size_t buckets = bucket_cnt (dir);
+      off_t start, end, ofs;
+
+      search_range (dir, name, &start, &end);
+      ofs = find_free (dir, start, end);
+      if (ofs < end)
+        {
+          e.in_use = true;
+          strlcpy (e.name, name, sizeof e.name);
+          e.inode_sector = inode_sector;
+          return inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+        }
+      if (buckets >= MAX_BUCKETS || !split_bucket (dir, buckets))
+        return false;
+    }
+}
+
+/* Converts linear directory DIR to an indexed directory.
+   Returns true if successful, false on failure. */
+static bool
+make_indexed (struct dir *dir)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+  size_t cnt = inode_length (dir->inode) / sizeof (struct dir_entry);
+  off_t size = cnt * sizeof (struct dir_entry);
+  off_t end = size > bucket_ofs (INITIAL_BUCKETS)
+              ? size : bucket_ofs (INITIAL_BUCKETS);
+  struct dir_entry *entries = malloc (size);
+  off_t ofs;
+  size_t i;
+  bool success;
+
+  if (entries == NULL)
+    return false;
+  success = inode_read_at (dir->inode, entries, size, 0) == size;
+  for (ofs = 0; success && ofs < end; ofs += BLOCK_SECTOR_SIZE)
+    success = inode_write_at (dir->inode, zeros, BLOCK_SECTOR_SIZE,
+                              ofs) == BLOCK_SECTOR_SIZE;
+  success = success && write_header (dir, INITIAL_BUCKETS);
+  for (i = 0; success && i < cnt; i++)
+    if (entries[i].in_use)
+      success = add_indexed (dir, entries[i].name, entries[i].inode_sector);
+  free (entries);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   "." names DIR itself.  A removed directory contains nothing. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
+  block_sector_t parent, child;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  parent = inode_get_inumber (dir->inode);
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode) || strlen (name) > NAME_MAX)
+    {
+      /* Nothing to find. */
+    }
+  else if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (dcache_get (parent, name, &child))
+    {
+      if (child != 0)
+        *inode = inode_open (child);
+    }
+  else if (lookup (dir, name, &e, NULL))
+    {
+      dcache_set (parent, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
-    *inode = NULL;
+    dcache_set (parent, name, 0);
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -152,21 +591,30 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use, and that DIR has not been
+     removed. */
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode)
+      || !strcmp (name, ".")
+      || lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (bucket_cnt (dir) != 0)
+    {
+      success = add_indexed (dir, name, inode_sector);
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+     current end-of-file. */
+  ofs = find_free (dir, 0, inode_length (dir->inode));
+  if (ofs >= (off_t) (LINEAR_MAX * sizeof e))
+    {
+      /* Too big to search linearly. */
+      success = make_indexed (dir) && add_indexed (dir, name, inode_sector);
+      goto done;
+    }
 
   /* Write slot. */
   e.in_use = true;
@@ -175,62 +623,201 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  if (success)
+    dcache_set (inode_get_inumber (dir->inode), name, inode_sector);
+  inode_unlock (dir->inode);
   return success;
 }
 
-/* Removes any entry for NAME in DIR.
+/* Returns X with the order of its bits reversed. */
+static uint32_t
+reverse_bits (uint32_t x)
+{
+  uint32_t y = 0;
+  int i;
+
+  for (i = 0; i < 32; i++)
+    {
+      y = (y << 1) | (x & 1);
+      x >>= 1;
+    }
+  return y;
+}
+
+/* Reads the next entry in indexed directory DIR, which has
+   BUCKETS buckets, like next_entry().
+
+   Entries are returned in order of their names' hashes with the
+   bits reversed, then of their names, and DIR's position is the
+   last (reversed hash, name) pair returned.  Each bucket holds
+   a contiguous range of reversed hashes, and splitting a bucket
+   divides its range in two, so the position stays meaningful
+   as the directory grows: no name is skipped or repeated. */
+static bool
+next_indexed (struct dir *dir, size_t buckets, char name[NAME_MAX + 1])
+{
+  const size_t size = BUCKET_ENTRIES * sizeof (struct dir_entry);
+  struct dir_entry *entries = malloc (size);
+  bool found = false;
+
+  if (entries == NULL)
+    return false;
+  while (!found && dir->hash_pos <= UINT32_MAX)
+    {
+      unsigned hash = reverse_bits (dir->hash_pos);
+      size_t mask = bucket_mask (hash, buckets);
+      uint32_t range = reverse_bits (mask);
+      size_t idx = hash & mask;
+      const struct dir_entry *best = NULL;
+      uint64_t best_pos = 0;
+      size_t j;
+
+      if (inode_read_at (dir->inode, entries, size,
+                         bucket_ofs (idx)) != (off_t) size)
+        break;
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        {
+          const struct dir_entry *e = &entries[j];
+          uint64_t pos;
+
+          if (!entry_in_use (e, buckets, idx)
+              || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+            continue;
+          pos = reverse_bits (hash_string (e->name));
+          if ((pos > dir->hash_pos
+               || (pos == dir->hash_pos
+                   && strcmp (e->name, dir->name_pos) > 0))
+              && (best == NULL || pos < best_pos
+                  || (pos == best_pos && strcmp (e->name, best->name) < 0)))
+            {
+              best = e;
+              best_pos = pos;
+            }
+        }
+
+      if (best != NULL)
+        {
+          dir->hash_pos = best_pos;
+          strlcpy (dir->name_pos, best->name, sizeof dir->name_pos);
+          strlcpy (name, best->name, NAME_MAX + 1);
+          found = true;
+        }
+      else
+        {
+          /* Go on to the start of the next bucket's range. */
+          dir->hash_pos = (dir->hash_pos & range) + (uint64_t) ~range + 1;
+          dir->name_pos[0] = '\0';
+        }
+    }
+  free (entries);
+  return found;
+}
+
+/* Reads the next entry in DIR other than "." and "..", and
+   stores its name in NAME.  Returns true if successful, false if
+   the directory contains no more entries. */
+static bool
+next_entry (struct dir *dir, char name[NAME_MAX + 1])
+{
+  struct dir_entry e;
+  size_t buckets = bucket_cnt (dir);
+
+  if (buckets != 0)
+    return next_indexed (dir, buckets, name);
+  for (;;)
+    {
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
+      dir->pos += sizeof e;
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
+        {
+          strlcpy (name, e.name, NAME_MAX + 1);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Returns true if directory INODE has no entries besides "..". */
+static bool
+is_empty (struct inode *inode)
+{
+  struct dir dir;
+  char name[NAME_MAX + 1];
+
+  memset (&dir, 0, sizeof dir);
+  dir.inode = inode;
+  return !next_entry (&dir, name);
+}
+
+/* Removes any entry for NAME in DIR.  A directory may be removed
+   only if it is empty.  Its lock is held, after DIR's, while it
+   is checked and removed, so that nothing can be added to it in
+   the meantime.  Directory locks are otherwise held one at a
+   time, so this order cannot deadlock.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME or it is
+   a directory that is not empty. */
 bool
 dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
+  bool locked = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!strcmp (name, "..") || !lookup (dir, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
   inode = inode_open (e.inode_sector);
   if (inode == NULL)
     goto done;
+  if (inode_is_dir (inode))
+    {
+      inode_lock (inode);
+      locked = true;
+      if (!is_empty (inode))
+        goto done;
+    }
 
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  dcache_set (inode_get_inumber (dir->inode), name, 0);
+  if (inode_is_dir (inode))
+    dcache_purge (e.inode_sector);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (locked)
+    inode_unlock (inode);
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are never returned. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  bool success;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        }
-    }
-  return false;
+  inode_lock (dir->inode);
+  success = next_entry (dir, name);
+  inode_unlock (dir->inode);
+  return success;
 }
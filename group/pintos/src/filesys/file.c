@@ -1,16 +1,30 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window limits, in bytes.  The window opens at
+   READ_AHEAD_MIN on a read that starts where the previous one
+   ended (or at offset 0, for a file's first read) and doubles
+   with each further such read, up to READ_AHEAD_MAX.  A read
+   anywhere else closes it again. */
+#define READ_AHEAD_MIN (2 * BLOCK_SECTOR_SIZE)
+#define READ_AHEAD_MAX (32 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t seq_next;             /* Offset a sequential read starts at. */
+    off_t ra_window;            /* Read-ahead window size, in bytes. */
+    off_t ra_end;               /* End of data already read ahead. */
   };
 
+static void read_ahead (struct file *, off_t ofs, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -69,6 +83,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,16 +96,55 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Tracks whether reads from FILE are sequential, given that the
+   last one read BYTES_READ bytes at offset OFS, and if so asks
+   for the data that is likely to be read next to be read ahead
+   into the buffer cache. */
+static void
+read_ahead (struct file *file, off_t ofs, off_t bytes_read)
+{
+  off_t end = ofs + bytes_read;
+
+  if (bytes_read == 0)
+    return;
+
+  if (ofs != file->seq_next)
+    {
+      /* Not sequential: close the window. */
+      file->ra_window = 0;
+      file->ra_end = end;
+    }
+  else
+    {
+      /* Sequential: open or grow the window, then request
+         whatever part of it has not been requested yet. */
+      if (file->ra_window == 0)
+        file->ra_window = READ_AHEAD_MIN;
+      else if (file->ra_window < READ_AHEAD_MAX)
+        file->ra_window *= 2;
+      if (file->ra_end < end)
+        file->ra_end = end;
+      if (file->ra_end < end + file->ra_window)
+        {
+          inode_read_ahead (file->inode, end + file->ra_window - file->ra_end,
+                            file->ra_end);
+          file->ra_end = end + file->ra_window;
+        }
+    }
+  file->seq_next = end;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
 {
@@ -102,9 +156,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
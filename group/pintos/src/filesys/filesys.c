@@ -2,32 +2,75 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/log.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* The file system is mounted the first time it is used, so that
+   booting a kernel that never touches it costs nothing more than
+   finding its partition.  Every entry point below calls
+   filesys_mount() before touching anything else, including the
+   log.  MOUNTED is only accessed with MOUNT_LOCK held. */
+static struct lock mount_lock;
+static bool mounted;
+
+static void mount (bool format);
 static void do_format (void);
+static struct dir *open_parent (const char *path, char name[NAME_MAX + 1]);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system right away;
+   otherwise, it is mounted when it is first used. */
 void
 filesys_init (bool format)
 {
+  lock_init (&mount_lock);
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
-  free_map_init ();
-
   if (format)
-    do_format ();
+    mount (true);
+}
 
-  free_map_open ();
+/* Mounts the file system if it is not mounted yet.  Must be
+   called before using the file system other than through the
+   filesys_*() functions, which call it themselves. */
+void
+filesys_mount (void)
+{
+  mount (false);
+}
+
+/* Mounts the file system, reformatting it first if FORMAT is
+   true, unless it is already mounted. */
+static void
+mount (bool format)
+{
+  lock_acquire (&mount_lock);
+  if (!mounted)
+    {
+      cache_init ();
+      log_init (format);
+      inode_init ();
+      dir_init ();
+      free_map_init ();
+
+      if (format)
+        do_format ();
+
+      free_map_open ();
+      mounted = true;
+    }
+  lock_release (&mount_lock);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,7 +78,19 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  free_map_close ();
+  /* Nothing to do if we panicked before filesys_init() or while
+     mounting. */
+  if (fs_device == NULL || lock_held_by_current_thread (&mount_lock))
+    return;
+
+  lock_acquire (&mount_lock);
+  if (mounted)
+    {
+      free_map_close ();
+      log_commit ();
+      cache_flush ();
+    }
+  lock_release (&mount_lock);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -46,14 +101,21 @@ bool
 filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  filesys_mount ();
+  log_begin ();
+  dir = open_parent (name, part);
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, part, inode_sector));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  log_end ();
 
   return success;
 }
@@ -66,38 +128,203 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char part[NAME_MAX + 1];
+  struct dir *dir;
   struct inode *inode = NULL;
 
+  filesys_mount ();
+  dir = open_parent (name, part);
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, part, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if it is a directory that
+   is not empty, or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name)
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  filesys_mount ();
+  log_begin ();
+  dir = open_parent (name, part);
+  success = dir != NULL && dir_remove (dir, part);
+  dir_close (dir);
+  log_end ();
+
+  return success;
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  block_sector_t inode_sector = 0;
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  bool created, success;
+
+  filesys_mount ();
+  log_begin ();
+  dir = open_parent (name, part);
+  created = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && dir_create (inode_sector, 16,
+                            inode_get_inumber (dir_get_inode (dir))));
+  success = created && dir_add (dir, part, inode_sector);
+  if (!success && created)
+    {
+      /* Free the new directory's inode and its data. */
+      struct inode *inode = inode_open (inode_sector);
+      if (inode != NULL)
+        inode_remove (inode);
+      inode_close (inode);
+    }
+  else if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
   dir_close (dir);
+  log_end ();
 
   return success;
 }
 
+/* Makes the directory named NAME the running thread's current
+   directory, against which relative names are resolved.
+   Returns true if successful, false if there is no directory
+   named NAME or if internal memory allocation fails. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  struct inode *inode = NULL;
+
+  filesys_mount ();
+  dir = open_parent (name, part);
+  if (dir != NULL)
+    dir_lookup (dir, part, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Opens the directory that PATH's last component is in, and
+   copies that component into NAME.  A PATH that starts with `/'
+   is resolved from the root directory, any other from the
+   running thread's current directory.  If PATH names the root
+   directory itself, NAME is set to ".".
+   Returns a null pointer if PATH is empty, if a component is too
+   long, or if a directory along the way does not exist. */
+static struct dir *
+open_parent (const char *path, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+  if (dir == NULL)
+    return NULL;
+
+  result = get_next_part (name, &path);
+  if (result == 0)
+    strlcpy (name, ".", NAME_MAX + 1);
+  while (result > 0)
+    {
+      struct inode *inode;
+
+      result = get_next_part (next, &path);
+      if (result <= 0)
+        break;
+
+      /* NAME is a directory along the way. */
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      if (inode == NULL || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          return NULL;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+  if (result < 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  log_begin ();
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  log_end ();
   free_map_close ();
   printf ("done.\n");
 }
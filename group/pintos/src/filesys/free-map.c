@@ -1,52 +1,168 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* The bitmap is the on-disk record of which sectors are in use,
+   but allocating from it means scanning it.  The free sectors are
+   also kept as an index of maximal runs ("extents"), which can be
+   looked up by start sector, by end sector (to merge freed
+   sectors with their neighbors), and roughly by size.
+
+   Released sectors are only indexed once the log transaction that
+   freed them has committed (see free_map_commit()).  Until then,
+   a crash would bring back the file that used them, so they must
+   not be reused yet.
+
+   If memory for a new extent cannot be allocated when sectors are
+   released, they stay free in the bitmap but are not indexed, so
+   they go unused until the index is rebuilt at the next boot. */
+struct extent
+  {
+    block_sector_t start;           /* First free sector. */
+    size_t length;                  /* Number of free sectors. */
+    struct hash_elem start_elem;    /* Element in extents_by_start. */
+    struct hash_elem end_elem;      /* Element in extents_by_end. */
+    struct list_elem size_elem;     /* Element in a size_classes list
+                                       or in released. */
+  };
+
+/* Extents of length 2**K through 2**(K + 1) - 1 are in
+   size_classes[K], except that the last class has no upper
+   bound. */
+#define SIZE_CLASS_CNT 16
+
+static struct hash extents_by_start;
+static struct hash extents_by_end;
+static struct list size_classes[SIZE_CLASS_CNT];
+static struct list released;         /* Released, not yet committed. */
+static struct lock free_map_lock;    /* Protects free_map and extents. */
+
+static void build_index (void);
+static void extent_insert (block_sector_t, size_t);
+static void extent_take (struct extent *, size_t);
+static struct extent *find_by_start (block_sector_t);
+static struct extent *find_best (size_t);
+static struct extent *find_largest (size_t);
+static bool allocate (struct extent *, size_t, block_sector_t *);
+static hash_hash_func start_hash, end_hash;
+static hash_less_func start_less, end_less;
+
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
+  size_t i;
+
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, LOG_SECTOR, LOG_CNT + 1, true);
+
+  lock_init (&free_map_lock);
+  if (!hash_init (&extents_by_start, start_hash, start_less, NULL)
+      || !hash_init (&extents_by_end, end_hash, end_less, NULL))
+    PANIC ("can't create free extent index");
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init (&size_classes[i]);
+  list_init (&released);
+  build_index ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Uses the smallest free extent that
+   is big enough, which suits metadata that will never grow.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_acquire (&free_map_lock);
+  return allocate (find_best (cnt), cnt, sectorp);
+}
+
+/* Allocates CNT consecutive sectors, preferably starting at
+   HINT, and stores the first into *SECTORP.  HINT is normally the
+   sector just past a file's last data sector, so that a growing
+   file stays contiguous.  If those sectors are taken, starts a
+   new run at the front of the largest free extent, to leave the
+   file room to grow.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  struct extent *e;
+
+  lock_acquire (&free_map_lock);
+  e = find_by_start (hint);
+  if (e == NULL || e->length < cnt)
+    e = find_largest (cnt);
+  return allocate (e, cnt, sectorp);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the log transaction that this is part of has committed. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct extent *e;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (free_map_file == NULL)
+    {
+      /* Still formatting: nothing is logged yet. */
+      extent_insert (sector, cnt);
+      lock_release (&free_map_lock);
+      return;
+    }
+  lock_release (&free_map_lock);
+
+  /* Queue the sectors only after logging the bitmap, so that the
+     commit that indexes them is never an earlier one. */
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  e = malloc (sizeof *e);
+  if (e == NULL)
+    return;
+  e->start = sector;
+  e->length = cnt;
+  lock_acquire (&free_map_lock);
+  list_push_back (&released, &e->size_elem);
+  lock_release (&free_map_lock);
+}
+
+/* Indexes the sectors released so far, so that they may be
+   allocated again.  Called by the log once it has committed the
+   transaction that released them. */
+void
+free_map_commit (void)
+{
+  lock_acquire (&free_map_lock);
+  while (!list_empty (&released))
+    {
+      struct extent *e = list_entry (list_pop_front (&released),
+                                     struct extent, size_elem);
+      extent_insert (e->start, e->length);
+      free (e);
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +174,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  build_index ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +189,272 @@ free_map_close (void)
 void
 free_map_create (void)
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The first write allocates the file's
+     sectors, which changes the bitmap as it goes, so write it
+     again afterward.  Allocations only start updating the file
+     once it is complete. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file) || !bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
+}
+
+/* Takes CNT sectors from the front of extent E, which may be
+   null if no extent was big enough, marks them in the free map,
+   and stores the first into *SECTORP.  Must be called with
+   free_map_lock held, which it releases.
+   Only the bitmap words that changed are written to the free map
+   file.  This goes through the buffer cache, which writes them
+   to disk later. */
+static bool
+allocate (struct extent *e, size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (e == NULL)
+    {
+      lock_release (&free_map_lock);
+      return false;
+    }
+  sector = e->start;
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  extent_take (e, cnt);
+  lock_release (&free_map_lock);
+
+  if (free_map_file != NULL
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+    {
+      free_map_release (sector, cnt);
+      return false;
+    }
+  *sectorp = sector;
+  return true;
+}
+
+/* Rebuilds the free extent index from the free map. */
+static void
+build_index (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t start, end;
+  size_t i;
+
+  hash_clear (&extents_by_end, NULL);
+  hash_clear (&extents_by_start, NULL);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    while (!list_empty (&size_classes[i]))
+      free (list_entry (list_pop_front (&size_classes[i]),
+                        struct extent, size_elem));
+
+  for (start = 0; start < sector_cnt; start = end)
+    {
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      extent_insert (start, end - start);
+    }
+}
+
+/* Returns the size class for an extent of LENGTH sectors. */
+static size_t
+size_class (size_t length)
+{
+  size_t class = 0;
+
+  ASSERT (length > 0);
+  while (length > 1 && class < SIZE_CLASS_CNT - 1)
+    {
+      length /= 2;
+      class++;
+    }
+  return class;
+}
+
+/* Adds extent E to the index. */
+static void
+index_extent (struct extent *e)
+{
+  hash_insert (&extents_by_start, &e->start_elem);
+  hash_insert (&extents_by_end, &e->end_elem);
+  list_push_front (&size_classes[size_class (e->length)], &e->size_elem);
+}
+
+/* Removes extent E from the index. */
+static void
+unindex_extent (struct extent *e)
+{
+  hash_delete (&extents_by_start, &e->start_elem);
+  hash_delete (&extents_by_end, &e->end_elem);
+  list_remove (&e->size_elem);
+}
+
+/* Indexes the CNT free sectors starting at START, merging them
+   with any free extents just before and after them. */
+static void
+extent_insert (block_sector_t start, size_t cnt)
+{
+  struct extent key;
+  struct hash_elem *h;
+  struct extent *prev = NULL, *next = NULL;
+
+  key.start = start;
+  key.length = 0;
+  h = hash_find (&extents_by_end, &key.end_elem);
+  if (h != NULL)
+    prev = hash_entry (h, struct extent, end_elem);
+  next = find_by_start (start + cnt);
+
+  if (prev != NULL)
+    {
+      unindex_extent (prev);
+      prev->length += cnt;
+      if (next != NULL)
+        {
+          unindex_extent (next);
+          prev->length += next->length;
+          free (next);
+        }
+      index_extent (prev);
+    }
+  else if (next != NULL)
+    {
+      unindex_extent (next);
+      next->start = start;
+      next->length += cnt;
+      index_extent (next);
+    }
+  else
+    {
+      struct extent *e = malloc (sizeof *e);
+      if (e == NULL)
+        return;
+      e->start = start;
+      e->length = cnt;
+      index_extent (e);
+    }
+}
+
+/* Removes the first CNT sectors from extent E, which must have
+   at least that many, freeing E if it becomes empty. */
+static void
+extent_take (struct extent *e, size_t cnt)
+{
+  ASSERT (e->length >= cnt);
+
+  unindex_extent (e);
+  e->start += cnt;
+  e->length -= cnt;
+  if (e->length > 0)
+    index_extent (e);
+  else
+    free (e);
+}
+
+/* Returns the free extent that starts at SECTOR, or a null
+   pointer if there is none. */
+static struct extent *
+find_by_start (block_sector_t sector)
+{
+  struct extent key;
+  struct hash_elem *h;
+
+  key.start = sector;
+  h = hash_find (&extents_by_start, &key.start_elem);
+  return h != NULL ? hash_entry (h, struct extent, start_elem) : NULL;
+}
+
+/* Returns the first extent in size class CLASS with at least CNT
+   sectors, or a null pointer if there is none. */
+static struct extent *
+first_fit (size_t class, size_t cnt)
+{
+  struct list_elem *le;
+
+  for (le = list_begin (&size_classes[class]);
+       le != list_end (&size_classes[class]); le = list_next (le))
+    {
+      struct extent *e = list_entry (le, struct extent, size_elem);
+      if (e->length >= cnt)
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns a free extent of at least CNT sectors from the smallest
+   size class that has one, or a null pointer if there is none. */
+static struct extent *
+find_best (size_t cnt)
+{
+  size_t class;
+
+  for (class = size_class (cnt); class < SIZE_CLASS_CNT; class++)
+    {
+      struct extent *e = first_fit (class, cnt);
+      if (e != NULL)
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns a free extent of at least CNT sectors from the largest
+   size class that has one, or a null pointer if there is none. */
+static struct extent *
+find_largest (size_t cnt)
+{
+  size_t class;
+
+  for (class = SIZE_CLASS_CNT; class-- > size_class (cnt); )
+    {
+      struct extent *e = first_fit (class, cnt);
+      if (e != NULL)
+        return e;
+    }
+  return NULL;
+}
+
+/* Hash and comparison functions for the extent index, keyed on
+   an extent's first sector and on the sector just past its end. */
+static unsigned
+start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  block_sector_t start = hash_entry (e, struct extent, start_elem)->start;
+  return hash_int (start);
+}
+
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct extent, start_elem)->start
+          < hash_entry (b, struct extent, start_elem)->start);
+}
+
+static unsigned
+end_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct extent *e = hash_entry (e_, struct extent, end_elem);
+  return hash_int (e->start + e->length);
+}
+
+static bool
+end_less (const struct hash_elem *a_, const struct hash_elem *b_,
+          void *aux UNUSED)
+{
+  const struct extent *a = hash_entry (a_, struct extent, end_elem);
+  const struct extent *b = hash_entry (b_, struct extent, end_elem);
+  return a->start + a->length < b->start + b->length;
 }
@@ -19,6 +19,7 @@ fsutil_ls (char **argv UNUSED)
   char name[NAME_MAX + 1];
 
   printf ("Files in the root directory:\n");
+  filesys_mount ();
   dir = dir_open_root ();
   if (dir == NULL)
     PANIC ("root dir open failed");
@@ -1,76 +1,341 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/log.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef USERPROG
+#include "userprog/process.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode. */
+#define DIRECT_CNT 122
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest number of data sectors a file can have. */
+#define MAX_FILE_SECTORS                                        \
+  (DIRECT_CNT + PTRS_PER_SECTOR + PTRS_PER_SECTOR * PTRS_PER_SECTOR \
+   + PTRS_PER_SECTOR * PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data sectors are found through DIRECT_CNT direct
+   pointers, then through the PTRS_PER_SECTOR pointers in the
+   indirect block, then through the doubly indirect block, which
+   points to up to PTRS_PER_SECTOR more indirect blocks, and
+   finally through the triply indirect block, which points to up
+   to PTRS_PER_SECTOR more doubly indirect blocks.  That allows
+   files of just over 1 GB, more than any disk Pintos will use
+   (see ide.c), so a file can grow to fill its disk.  A null
+   pointer (sector 0, which always holds the free map inode)
+   means that part of the file has never been written, and it
+   reads as zeros. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
+    block_sector_t triply_indirect;     /* Triply indirect block. */
     off_t length;                       /* File size in bytes. */
+    bool is_dir;                        /* Directory or ordinary file? */
+    uint8_t unused[3];                  /* Not used. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* In-memory inode.
 
-/* In-memory inode. */
+   Reads and writes of a file proceed in parallel.  RWLOCK guards
+   the sector pointers in DATA: threads that look up sectors hold
+   it for reading, and a thread that allocates a sector holds it
+   for writing.  The data in each sector is protected by the
+   buffer cache.
+
+   Writers that may extend the file also hold EXTEND_LOCK, so
+   that only one grows it at a time.  Readers never take it.  The
+   new length is stored only after the data up to it has been
+   written, and a single aligned word is read atomically, so
+   inode_length() needs no lock and never exposes bytes that are
+   not there yet. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Still being read from disk? */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Protects sector pointers. */
+    struct lock extend_lock;            /* Held while extending the file. */
+    struct lock dir_lock;               /* Directories: see inode_lock(). */
+    block_sector_t next_sector;         /* Preferred next data sector. */
+    bool exec_cached;                   /* May be in the exec cache. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, fills it with zeros, and returns it.
+   A data sector is placed at *HINT if possible, and *HINT is
+   advanced past it so that the next one follows it on disk.
+   Indirect blocks, which pass a null HINT, go wherever they fit
+   best instead.
+   Returns 0 if the disk is full. */
+static block_sector_t
+allocate_zeroed (block_sector_t *hint)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (hint != NULL)
+    {
+      if (!free_map_allocate_near (*hint, 1, &sector))
+        return 0;
+      *hint = sector + 1;
+      cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (!free_map_allocate (1, &sector))
+        return 0;
+      log_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+    }
+  return sector;
+}
+
+/* Returns the sector that pointer *SLOT, held in memory, points
+   to.  If it is null and CREATE is true, first points it to a
+   newly allocated zeroed sector, placed according to HINT as
+   described for allocate_zeroed(), and sets *CHANGED to true.
+   Returns 0 if the pointer is null and CREATE is false, or if
+   allocation fails. */
+static block_sector_t
+follow_slot (block_sector_t *slot, bool create, bool *changed,
+             block_sector_t *hint)
+{
+  if (*slot == 0 && create)
+    {
+      *slot = allocate_zeroed (hint);
+      if (*slot != 0)
+        *changed = true;
+    }
+  return *slot;
+}
+
+/* Like follow_slot(), for pointer IDX in indirect block
+   INDIRECT, which is read and written through the buffer
+   cache. */
+static block_sector_t
+follow_indirect (block_sector_t indirect, size_t idx, bool create,
+                 block_sector_t *hint)
+{
+  off_t ofs = idx * sizeof (block_sector_t);
+  block_sector_t sector;
+
+  ASSERT (idx < PTRS_PER_SECTOR);
+
+  cache_read (indirect, &sector, ofs, sizeof sector);
+  if (sector == 0 && create)
+    {
+      sector = allocate_zeroed (hint);
+      if (sector != 0)
+        log_write (indirect, &sector, ofs, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns the block device sector that holds sector IDX of the
+   file whose inode is DISK_INODE.  If that part of the file has
+   no sector yet and CREATE is true, allocates a zeroed one, along
+   with any indirect blocks needed to reach it, and sets
+   *CHANGED to true if DISK_INODE itself was modified.  The new
+   data sector is placed at *HINT if possible, and *HINT is
+   advanced past it.
+   Returns 0 if there is no such sector and CREATE is false, or
+   if IDX is too big or allocation fails. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk_inode, size_t idx, bool create,
+                 bool *changed, block_sector_t *hint)
+{
+  const size_t per_doubly = PTRS_PER_SECTOR * PTRS_PER_SECTOR;
+  block_sector_t indirect;
+
+  if (idx < DIRECT_CNT)
+    return follow_slot (&disk_inode->direct[idx], create, changed, hint);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      indirect = follow_slot (&disk_inode->indirect, create, changed, NULL);
+      return indirect != 0 ? follow_indirect (indirect, idx, create, hint) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < per_doubly)
+    {
+      indirect = follow_slot (&disk_inode->doubly_indirect, create, changed,
+                              NULL);
+      if (indirect != 0)
+        indirect = follow_indirect (indirect, idx / PTRS_PER_SECTOR, create,
+                                    NULL);
+      if (indirect != 0)
+        return follow_indirect (indirect, idx % PTRS_PER_SECTOR, create,
+                                hint);
+      return 0;
+    }
+  idx -= per_doubly;
+
+  if (idx < per_doubly * PTRS_PER_SECTOR)
+    {
+      indirect = follow_slot (&disk_inode->triply_indirect, create, changed,
+                              NULL);
+      if (indirect != 0)
+        indirect = follow_indirect (indirect, idx / per_doubly, create,
+                                    NULL);
+      if (indirect != 0)
+        indirect = follow_indirect (indirect,
+                                    idx / PTRS_PER_SECTOR % PTRS_PER_SECTOR,
+                                    create, NULL);
+      if (indirect != 0)
+        return follow_indirect (indirect, idx % PTRS_PER_SECTOR, create,
+                                hint);
+    }
+  return 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if no sector has been allocated for it. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
+  bool changed = false;
+  block_sector_t sector;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  rwlock_read_acquire (&inode->rwlock);
+  sector = index_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE, false,
+                            &changed, NULL);
+  rwlock_read_release (&inode->rwlock);
+  return sector;
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE, allocating it if necessary, and sets *CHANGED to
+   true if INODE's sector pointers were modified.  Returns 0 if
+   the disk is full or POS is too big. */
+static block_sector_t
+byte_to_sector_create (struct inode *inode, off_t pos, bool *changed)
+{
+  block_sector_t sector = byte_to_sector (inode, pos);
+
+  if (sector == 0)
+    {
+      rwlock_write_acquire (&inode->rwlock);
+      sector = index_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE, true,
+                                changed, &inode->next_sector);
+      rwlock_write_release (&inode->rwlock);
+    }
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees indirect block SECTOR and, if LEVEL is greater than 1,
+   the blocks it points to, down to LEVEL levels of indirection. */
+static void
+deallocate_indirect (block_sector_t sector, int level)
+{
+  block_sector_t *ptrs = malloc (BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  if (ptrs == NULL)
+    return;
+  cache_read (sector, ptrs, 0, BLOCK_SECTOR_SIZE);
+  for (i = 0; i < PTRS_PER_SECTOR; i++)
+    if (ptrs[i] != 0)
+      {
+        if (level > 1)
+          deallocate_indirect (ptrs[i], level - 1);
+        else
+          free_map_release (ptrs[i], 1);
+      }
+  free (ptrs);
+  free_map_release (sector, 1);
+}
+
+/* Frees all the data and indirect blocks of DISK_INODE. */
+static void
+deallocate (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk_inode->direct[i] != 0)
+      free_map_release (disk_inode->direct[i], 1);
+  if (disk_inode->indirect != 0)
+    deallocate_indirect (disk_inode->indirect, 1);
+  if (disk_inode->doubly_indirect != 0)
+    deallocate_indirect (disk_inode->doubly_indirect, 2);
+  if (disk_inode->triply_indirect != 0)
+    deallocate_indirect (disk_inode->triply_indirect, 3);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Signaled when an inode in open_inodes finishes loading. */
+static struct condition inode_loaded;
+
+/* Protects open_inodes and the open_cnt and loading members of
+   each inode in   it. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create open inode table");
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if A's inode precedes B's by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is for a directory if IS_DIR is true.
+   No data sectors are allocated: the data reads as zeros until
+   it is written, and sectors are allocated then.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   big. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,26 +346,18 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if ((size_t) DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE) > MAX_FILE_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
+      disk_inode->is_dir = is_dir;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true;
-        }
+      log_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
       free (disk_inode);
+      success = true;
     }
   return success;
 }
@@ -111,33 +368,64 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  /* Check whether this inode is already open.  If another thread
+     is still reading it from disk, wait for it to finish. */
+  lock_acquire (&open_inodes_lock);
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->exec_cached = true;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->extend_lock);
+  lock_init (&inode->dir_lock);
+
+  /* Publish the inode, marked as loading, and read it from disk
+     without holding the lock, so that opens of other inodes need
+     not wait for the read. */
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  /* New data goes right after the last sector, if possible. */
+  inode->next_sector = 0;
+  if (inode->data.length > 0)
+    {
+      block_sector_t last = byte_to_sector (inode, inode->data.length - 1);
+      if (last != 0)
+        inode->next_sector = last + 1;
+    }
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +434,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,22 +455,29 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode)
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* Once no one has it open, no one else can find it. */
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          log_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          deallocate (&inode->data);
+          log_end ();
         }
 
       free (inode);
@@ -192,6 +491,9 @@ inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
   inode->removed = true;
+#ifdef USERPROG
+  process_image_invalidate (inode->sector);
+#endif
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,7 +504,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t length = inode_length (inode);
 
   while (size > 0)
     {
@@ -211,7 +513,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,23 +522,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      if (sector_idx != 0)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Never written, so it reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
 
       /* Advance. */
@@ -244,75 +535,117 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Starts bringing the sectors that hold the SIZE bytes at OFFSET
+   in INODE into the buffer cache, without waiting for them.
+   Sectors that are consecutive on disk are requested as one run,
+   so that they can be read with a single disk request.  Bytes
+   past the end of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+  block_sector_t first = 0;
+  size_t cnt = 0;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (cnt > 0 && sector == first + cnt)
+        cnt++;
+      else
+        {
+          if (cnt > 0)
+            cache_prefetch (first, cnt);
+          first = sector;
+          cnt = sector != 0;
+        }
+    }
+  if (cnt > 0)
+    cache_prefetch (first, cnt);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.  Writing past end of file extends the file.
+   Only the sectors actually written are allocated, so any gap
+   between the old end of file and OFFSET reads as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool changed = false;
+  bool metadata = inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+  bool extending = offset + size > inode_length (inode);
 
   if (inode->deny_write_cnt)
     return 0;
 
+  log_begin ();
+  if (extending)
+    lock_acquire (&inode->extend_lock);
+
+#ifdef USERPROG
+  /* Cached executable headers are stale once the file changes. */
+  if (inode->exec_cached)
+    {
+      inode->exec_cached = false;
+      process_image_invalidate (inode->sector);
+    }
+#endif
+
   while (size > 0)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, allocating it if necessary, and starting
+         byte offset within sector. */
+      block_sector_t sector_idx
+        = byte_to_sector_create (inode, offset, &changed);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
+      if (metadata)
+        log_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
       else
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+        cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                     chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file, now that the data is in place, and write
+     back the inode if it changed. */
+  if (changed || (bytes_written > 0 && offset > inode_length (inode)))
+    {
+      rwlock_write_acquire (&inode->rwlock);
+      if (bytes_written > 0 && offset > inode->data.length)
+        {
+          barrier ();
+          inode->data.length = offset;
+        }
+      log_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+      rwlock_write_release (&inode->rwlock);
+    }
+  if (extending)
+    lock_release (&inode->extend_lock);
+  log_end ();
 
   return bytes_written;
 }
@@ -337,7 +670,51 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir;
+}
+
+/* Acquires INODE's directory lock, which the directory code
+   holds while it reads or changes the entries of directory
+   INODE, so that operations on different directories proceed in
+   parallel. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Notes that INODE's executable headers are being cached, so
+   that the cache is told when INODE is next written.  A newly
+   opened inode is assumed to be cached, since the cache outlives
+   the inodes it describes. */
+void
+inode_set_exec_cached (struct inode *inode)
+{
+  inode->exec_cached = true;
+}
+
+/* Returns true if INODE has been removed, so that it is deleted
+   once it is no longer open. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the length, in bytes, of INODE's data.  Needs no lock;
+   see struct inode. */
 off_t
 inode_length (const struct inode *inode)
 {
@@ -0,0 +1,314 @@
+#include "filesys/log.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead log for file system metadata.
+
+   Inodes, indirect blocks, directories and the free map are
+   metadata: if a crash leaves only some of the sectors that an
+   operation such as creating a file changed on disk, the file
+   system is corrupt.  Such an operation is bracketed by
+   log_begin() and log_end(), and it writes metadata with
+   log_write().  That updates the sector in the buffer cache but
+   keeps it from being written back.
+
+   File data is not logged, but it is ordered: committing first
+   writes back every dirty sector that is not logged, so that no
+   committed inode or indirect block can point to a data sector
+   whose contents have not reached the disk.  Committing then
+   copies every changed sector into the log area in one
+   sequential burst and writes the log header, which makes the
+   whole transaction durable.  Only then are the sectors
+   written to their home locations, after which the header is
+   cleared.  After a crash, log_init() replays a transaction whose
+   header was written but not cleared.
+
+   Operations join the open transaction (group commit), which is
+   committed once no operation is in progress, when the log is
+   nearly full, every COMMIT_INTERVAL ticks and at shutdown.
+   Repeated changes to one sector within a transaction are
+   absorbed into a single logged copy.
+
+   Each operation in progress has OP_RESERVE sectors of the log
+   set aside for it, out of the first three quarters of the log;
+   the last quarter absorbs operations that write more than that.
+   Once the reserved part overflows, no new operations start, and
+   the transaction is committed when the ones in progress end.
+   An operation that still fills the whole log, such as a large
+   file write, commits it on the spot, partway through itself and
+   any other operations in progress, which are then not atomic.
+   It cannot wait for the others to end instead: they may be
+   waiting for a lock it holds, or be filling the log too. */
+
+/* Identifies a log header. */
+#define LOG_MAGIC 0x4c4f4721
+
+/* Log sectors set aside for each operation in progress.  A new
+   operation waits for a commit if the log might not have room. */
+#define OP_RESERVE 8
+
+/* How often the commit thread commits the open transaction. */
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* On-disk log header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct log_header
+  {
+    unsigned magic;                     /* LOG_MAGIC. */
+    uint32_t cnt;                       /* Number of committed sectors. */
+    block_sector_t sectors[LOG_CNT];    /* Home of each logged sector. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - LOG_CNT * 4];
+  };
+
+static struct lock log_lock;            /* Protects everything below. */
+static struct condition log_changed;    /* Operation ended or committed. */
+static block_sector_t logged[LOG_CNT];  /* Sectors in open transaction. */
+static size_t logged_cnt;               /* Number of LOGGED sectors. */
+static size_t log_capacity;             /* Maximum LOGGED_CNT. */
+static size_t reserve_capacity;         /* Part that operations reserve. */
+static int outstanding;                 /* Operations in progress. */
+static bool commit_wanted;              /* Hold off new operations? */
+static struct log_header *header;       /* Buffer for the header. */
+static uint8_t *staging;                /* LOG_CAPACITY sectors. */
+
+/* Statistics. */
+static long long commit_cnt, logged_sector_cnt, absorbed_cnt;
+static long long forced_cnt, recovered_cnt;
+
+static void commit (void);
+static void recover (void);
+static thread_func commit_daemon NO_RETURN;
+
+/* Initializes the log and starts its commit thread.  Unless
+   FORMAT is true, first replays any transaction that was
+   committed but not yet written to its home locations. */
+void
+log_init (bool format)
+{
+  ASSERT (sizeof *header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&log_lock);
+  cond_init (&log_changed);
+  header = calloc (1, sizeof *header);
+  if (header == NULL)
+    PANIC ("can't allocate log header");
+
+  /* Logged sectors stay in the buffer cache until committed, so
+     leave most of the cache for everything else. */
+  log_capacity = cache_size / 2;
+  if (log_capacity > LOG_CNT)
+    log_capacity = LOG_CNT;
+  if (log_capacity < 1)
+    log_capacity = 1;
+  reserve_capacity = log_capacity - log_capacity / 4;
+  staging = malloc (log_capacity * BLOCK_SECTOR_SIZE);
+  if (staging == NULL)
+    PANIC ("can't allocate log staging buffer");
+
+  if (!format)
+    recover ();
+  header->magic = LOG_MAGIC;
+  header->cnt = 0;
+  block_write (fs_device, LOG_SECTOR, header);
+
+  thread_create ("log-commit", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Starts a file system operation whose metadata changes must
+   reach the disk together.  Operations may nest, in which case
+   only the outermost one counts. */
+void
+log_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->log_depth++ > 0)
+    return;
+
+  /* Wait for room for one more operation's reservation.  An
+     operation may always start in an empty, idle log, even one
+     smaller than OP_RESERVE. */
+  lock_acquire (&log_lock);
+  while (commit_wanted
+         || ((logged_cnt > 0 || outstanding > 0)
+             && (logged_cnt + (outstanding + 1) * OP_RESERVE
+                 > reserve_capacity)))
+    {
+      if (outstanding == 0)
+        commit ();
+      else
+        {
+          commit_wanted = true;
+          cond_wait (&log_changed, &log_lock);
+        }
+    }
+  outstanding++;
+  lock_release (&log_lock);
+}
+
+/* Ends an operation started with log_begin().  Commits the open
+   transaction if a commit is waiting for this to be the last
+   operation in progress.  Either way, wakes up log_commit() if it
+   is waiting for operations to end. */
+void
+log_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->log_depth > 0);
+  if (--t->log_depth > 0)
+    return;
+
+  lock_acquire (&log_lock);
+  ASSERT (outstanding > 0);
+  if (--outstanding == 0 && commit_wanted)
+    commit ();
+  cond_broadcast (&log_changed, &log_lock);
+  lock_release (&log_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into metadata SECTOR starting at
+   offset OFS, as part of the running thread's operation. */
+void
+log_write (block_sector_t sector, const void *buffer, off_t ofs, off_t size)
+{
+  size_t i;
+
+  ASSERT (thread_current ()->log_depth > 0);
+
+  lock_acquire (&log_lock);
+  for (i = 0; i < logged_cnt; i++)
+    if (logged[i] == sector)
+      break;
+  if (i < logged_cnt)
+    absorbed_cnt++;
+  else
+    {
+      /* Past the reserved part of the log, let the operations in
+         progress finish but start no more. */
+      if (logged_cnt >= reserve_capacity)
+        commit_wanted = true;
+
+      /* If the log is full, commit it now. */
+      if (logged_cnt >= log_capacity)
+        {
+          forced_cnt++;
+          commit ();
+        }
+      logged[logged_cnt++] = sector;
+    }
+  cache_write_logged (sector, buffer, ofs, size);
+  lock_release (&log_lock);
+}
+
+/* Waits for operations in progress to finish and commits the
+   open transaction.  Must not be called within an operation. */
+void
+log_commit (void)
+{
+  ASSERT (thread_current ()->log_depth == 0);
+
+  lock_acquire (&log_lock);
+  if (logged_cnt > 0)
+    {
+      commit_wanted = true;
+      while (outstanding > 0)
+        cond_wait (&log_changed, &log_lock);
+      commit ();
+    }
+  lock_release (&log_lock);
+}
+
+/* Prints log statistics. */
+void
+log_print_stats (void)
+{
+  printf ("Log: %lld commits of %lld sectors, %lld writes absorbed, "
+          "%lld forced commits, %lld sectors recovered\n",
+          commit_cnt, logged_sector_cnt, absorbed_cnt, forced_cnt,
+          recovered_cnt);
+}
+
+/* Commits the open transaction, if it is not empty, and wakes up
+   threads waiting to start operations.  The caller must hold
+   log_lock. */
+static void
+commit (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&log_lock));
+
+  if (logged_cnt > 0)
+    {
+      /* Write back file data first, then copy the changed sectors
+         into the log with one disk request, then write the
+         header, which commits them. */
+      cache_flush ();
+      for (i = 0; i < logged_cnt; i++)
+        cache_read (logged[i], staging + i * BLOCK_SECTOR_SIZE,
+                    0, BLOCK_SECTOR_SIZE);
+      block_write_multi (fs_device, LOG_SECTOR + 1, logged_cnt, staging);
+      header->cnt = logged_cnt;
+      memcpy (header->sectors, logged, logged_cnt * sizeof *logged);
+      block_write (fs_device, LOG_SECTOR, header);
+      free_map_commit ();
+
+      /* Write the sectors home, then empty the log. */
+      for (i = 0; i < logged_cnt; i++)
+        cache_install (logged[i]);
+      header->cnt = 0;
+      block_write (fs_device, LOG_SECTOR, header);
+
+      commit_cnt++;
+      logged_sector_cnt += logged_cnt;
+      logged_cnt = 0;
+    }
+  commit_wanted = false;
+  cond_broadcast (&log_changed, &log_lock);
+}
+
+/* Writes the sectors of a committed transaction found in the log
+   to their home locations.  Runs before anything else reads the
+   file system, so the buffer cache holds none of them. */
+static void
+recover (void)
+{
+  uint8_t *buffer;
+  size_t i;
+
+  block_read (fs_device, LOG_SECTOR, header);
+  if (header->magic != LOG_MAGIC || header->cnt == 0
+      || header->cnt > LOG_CNT)
+    return;
+
+  buffer = malloc (header->cnt * BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    PANIC ("can't allocate log recovery buffer");
+  block_read_multi (fs_device, LOG_SECTOR + 1, header->cnt, buffer);
+  for (i = 0; i < header->cnt; i++)
+    block_write (fs_device, header->sectors[i],
+                 buffer + i * BLOCK_SECTOR_SIZE);
+  recovered_cnt = header->cnt;
+  free (buffer);
+}
+
+/* Commits the open transaction every COMMIT_INTERVAL ticks, so
+   that a crash loses at most that much work. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      log_commit ();
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef FILESYS_LOG_H
+#define FILESYS_LOG_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Sectors reserved for the log: a header in LOG_SECTOR, followed
+   by LOG_CNT sectors of logged data. */
+#define LOG_SECTOR 2
+#define LOG_CNT 64
+
+void log_init (bool format);
+void log_begin (void);
+void log_end (void);
+void log_write (block_sector_t, const void *buffer, off_t ofs, off_t size);
+void log_commit (void);
+void log_print_stats (void);
+
+#endif /* filesys/log.h */
@@ -0,0 +1,44 @@
+#ifndef __LIB_IOSTAT_H
+#define __LIB_IOSTAT_H
+
+/* Block device statistics, as returned to user programs by the
+   iostat system call. */
+
+#include <stdint.h>
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took from 2**I to 2**(I+1) - 1 nanoseconds;
+   bucket 0 also counts those that took no time and the last
+   bucket all that took longer. */
+#define IOSTAT_BUCKETS 40
+
+/* Statistics for one direction of transfer. */
+struct iostat_op
+  {
+    uint64_t requests;                  /* Requests submitted. */
+    uint64_t bytes;                     /* Bytes requested. */
+    uint64_t completed;                 /* Requests timed. */
+    uint64_t ns;                        /* Their total latency. */
+    uint64_t latency[IOSTAT_BUCKETS];   /* Their latency histogram. */
+  };
+
+/* Statistics for a block device.
+
+   Every request is counted by each device it passes through,
+   such as a partition and the disk that holds it, but its
+   latency and the queue depth are only charged to the device it
+   was submitted to. */
+struct iostat
+  {
+    char name[16];              /* Device name, e.g. "hda1". */
+    char type[16];              /* Type or role, e.g. "filesys". */
+    uint64_t size;              /* Size in bytes. */
+    struct iostat_op read;      /* Reads. */
+    struct iostat_op write;     /* Writes. */
+    uint64_t sequential;        /* Requests starting where the last ended. */
+    uint64_t random;            /* Other requests. */
+    uint64_t depth_sum;         /* Sum of queue depths seen on submit. */
+    uint32_t max_depth;         /* Largest queue depth. */
+  };
+
+#endif /* lib/iostat.h */
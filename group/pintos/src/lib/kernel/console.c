@@ -1,14 +1,54 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
-static void putchar_have_lock (uint8_t c);
+static void acquire_console (void);
+static void release_console (void);
+static void putbuf_have_lock (const char *, size_t);
+
+/* Output of one vprintf() call, collected so that it can be
+   passed to the serial port in batches. */
+struct vprintf_aux
+  {
+    int char_cnt;               /* Number of characters output. */
+    size_t buf_cnt;             /* Number of characters in BUF. */
+    char buf[128];              /* Characters not yet written. */
+  };
+
+/* Asynchronous mode.
+
+   Once console_start_async() has been called, output is not
+   written to the display and serial port by the thread that
+   produces it.  Instead, it is appended to LOG_BUF with
+   interrupts briefly off, without taking the console lock, and a
+   low-priority "console" thread writes it out.  A printf() call
+   is appended in pieces of up to 128 bytes, so longer output
+   from different threads may interleave.
+
+   If LOG_BUF has no room, the producer falls back to taking the
+   console lock, writing out LOG_BUF itself and then its own
+   output.  After a kernel panic, console_panic() writes out
+   LOG_BUF and returns the console to synchronous mode. */
+
+/* Log buffer size, in bytes.  Must be a power of 2. */
+#define LOG_BUFSIZE 16384
+
+static bool async_mode;                 /* Asynchronous mode on? */
+static char log_buf[LOG_BUFSIZE];       /* Output not yet written. */
+static unsigned log_head, log_tail;     /* Free-running indexes. */
+static struct semaphore log_ready;      /* Up'd when LOG_BUF gets data. */
+
+static bool log_append (const char *, size_t);
+static void log_drain_have_lock (void);
+static thread_func log_daemon NO_RETURN;
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -74,6 +114,28 @@ void
 console_panic (void)
 {
   use_console_lock = false;
+  async_mode = false;
+  log_drain_have_lock ();
+}
+
+/* Switches the console to asynchronous mode, starting the thread
+   that writes out buffered output. */
+void
+console_start_async (void)
+{
+  sema_init (&log_ready, 0);
+  thread_create ("console", PRI_MIN, log_daemon, NULL);
+  async_mode = true;
+}
+
+/* Writes out all buffered output, so that it is not lost when
+   the machine powers off. */
+void
+console_flush (void)
+{
+  acquire_console ();
+  log_drain_have_lock ();
+  release_console ();
 }
 
 /* Prints console statistics. */
@@ -119,19 +181,35 @@ console_locked_by_current_thread (void)
           || lock_held_by_current_thread (&console_lock));
 }
 
+/* Acquires the console lock, unless in asynchronous mode.
+   Returns true if the caller must call release_console(). */
+static bool
+lock_for_output (void)
+{
+  if (async_mode)
+    return false;
+  acquire_console ();
+  return true;
+}
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
    Writes its output to both vga display and serial port. */
 int
 vprintf (const char *format, va_list args)
 {
-  int char_cnt = 0;
+  struct vprintf_aux aux;
+  bool locked;
 
-  acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
-  release_console ();
+  aux.char_cnt = 0;
+  aux.buf_cnt = 0;
+  locked = lock_for_output ();
+  __vprintf (format, args, vprintf_helper, &aux);
+  putbuf (aux.buf, aux.buf_cnt);
+  if (locked)
+    release_console ();
 
-  return char_cnt;
+  return aux.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -139,11 +217,11 @@ vprintf (const char *format, va_list args)
 int
 puts (const char *s)
 {
-  acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
-  putchar_have_lock ('\n');
-  release_console ();
+  bool locked = lock_for_output ();
+  putbuf (s, strlen (s));
+  putbuf ("\n", 1);
+  if (locked)
+    release_console ();
 
   return 0;
 }
@@ -152,9 +230,12 @@ puts (const char *s)
 void
 putbuf (const char *buffer, size_t n)
 {
+  if (n == 0 || log_append (buffer, n))
+    return;
+
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  log_drain_have_lock ();
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -162,30 +243,109 @@ putbuf (const char *buffer, size_t n)
 int
 putchar (int c)
 {
-  acquire_console ();
-  putchar_have_lock (c);
-  release_console ();
+  char ch = c;
+  putbuf (&ch, 1);
 
   return c;
 }
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_)
+vprintf_helper (char c, void *aux_)
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct vprintf_aux *aux = aux_;
+  aux->char_cnt++;
+  aux->buf[aux->buf_cnt++] = c;
+  if (aux->buf_cnt >= sizeof aux->buf)
+    {
+      putbuf (aux->buf, aux->buf_cnt);
+      aux->buf_cnt = 0;
+    }
 }
 
-/* Writes C to the vga display and serial port.
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, passing them to the serial port all at once.
    The caller has already acquired the console lock if
    appropriate. */
 static void
-putchar_have_lock (uint8_t c)
+putbuf_have_lock (const char *buffer, size_t n)
+{
+  size_t i;
+
+  ASSERT (console_locked_by_current_thread ());
+  write_cnt += n;
+  serial_write (buffer, n);
+  for (i = 0; i < n; i++)
+    vga_putc (buffer[i]);
+}
+
+/* In asynchronous mode, appends the N characters in BUFFER to the
+   log buffer and returns true.  Returns false if not in
+   asynchronous mode or if the log buffer lacks room. */
+static bool
+log_append (const char *buffer, size_t n)
+{
+  enum intr_level old_level;
+  unsigned ofs, chunk;
+  bool was_empty;
+
+  if (!async_mode)
+    return false;
+
+  old_level = intr_disable ();
+  if (n > LOG_BUFSIZE - (log_head - log_tail))
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  was_empty = log_head == log_tail;
+  ofs = log_head % LOG_BUFSIZE;
+  chunk = n < LOG_BUFSIZE - ofs ? n : LOG_BUFSIZE - ofs;
+  memcpy (log_buf + ofs, buffer, chunk);
+  memcpy (log_buf, buffer + chunk, n - chunk);
+  log_head += n;
+  intr_set_level (old_level);
+
+  if (was_empty)
+    sema_up (&log_ready);
+  return true;
+}
+
+/* Writes out everything in the log buffer.  The caller has
+   already acquired the console lock if appropriate. */
+static void
+log_drain_have_lock (void)
 {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      unsigned ofs = log_tail % LOG_BUFSIZE;
+      unsigned cnt = log_head - log_tail;
+      char buf[128];
+
+      if (cnt > sizeof buf)
+        cnt = sizeof buf;
+      if (cnt > LOG_BUFSIZE - ofs)
+        cnt = LOG_BUFSIZE - ofs;
+      memcpy (buf, log_buf + ofs, cnt);
+      log_tail += cnt;
+      intr_set_level (old_level);
+
+      if (cnt == 0)
+        break;
+      putbuf_have_lock (buf, cnt);
+    }
+}
+
+/* Writes out the log buffer whenever it has something in it. */
+static void
+log_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&log_ready);
+      console_flush ();
+    }
 }
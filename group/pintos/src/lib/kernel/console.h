@@ -3,6 +3,8 @@
 
 void console_init (void);
 void console_panic (void);
+void console_start_async (void);
+void console_flush (void);
 void console_print_stats (void);
 
 #endif /* lib/kernel/console.h */
@@ -29,7 +29,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Statistics. */
+    SYS_IOSTAT,                 /* Obtains a block device's statistics. */
+    SYS_CLOCK_GETTIME           /* Reads a clock. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,19 @@
+#ifndef __LIB_TIME_H
+#define __LIB_TIME_H
+
+/* Time of day, as returned to user programs by the clock_gettime
+   system call. */
+
+#include <stdint.h>
+
+/* Clocks that clock_gettime() can read. */
+#define CLOCK_MONOTONIC 1       /* Time since boot, never decreasing. */
+
+/* A time in seconds and nanoseconds. */
+struct timespec
+  {
+    int64_t tv_sec;             /* Seconds. */
+    int32_t tv_nsec;            /* Nanoseconds, 0 to 999,999,999. */
+  };
+
+#endif /* lib/time.h */
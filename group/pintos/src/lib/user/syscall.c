@@ -188,3 +188,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+iostat (int dev, struct iostat *stats)
+{
+  return syscall2 (SYS_IOSTAT, dev, stats);
+}
+
+int
+clock_gettime (int clock, struct timespec *ts)
+{
+  return syscall2 (SYS_CLOCK_GETTIME, clock, ts);
+}
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <iostat.h>
+#include <time.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -46,4 +48,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Statistics. */
+bool iostat (int dev, struct iostat *);
+int clock_gettime (int clock, struct timespec *);
+
 #endif /* lib/user/syscall.h */
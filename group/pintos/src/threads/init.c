@@ -25,15 +25,20 @@
 #ifdef USERPROG
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
+#include "userprog/pingpong.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/usage.h"
 #else
 #include "tests/threads/tests.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -41,6 +46,9 @@
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* CR4 bit that enables 4 MB pages. */
+#define CR4_PSE 0x10
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -49,16 +57,35 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk-load: Copy the scratch device into the RAM disk? */
+static bool load_ramdisk;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
 #endif /* FILESYS */
 
+/* -async-log: Write console output from a background thread? */
+static bool async_console;
+
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* Boot phases timed by boot_phase(), for the report printed
+   before running the actions. */
+#define BOOT_PHASE_CNT 8
+static struct boot_phase {
+  const char *name; /* Name of the phase. */
+  int64_t ns;       /* Time spent in it. */
+} boot_phases[BOOT_PHASE_CNT];
+static size_t boot_phase_cnt;
+static int64_t boot_phase_start;
+
 static void bss_init(void);
+static bool cpu_has_pse(void);
 static void paging_init(void);
+static void boot_phase(const char *name);
+static void print_boot_phases(void);
 
 static char **read_command_line(void);
 static char **parse_options(char **argv);
@@ -111,20 +138,33 @@ int main(void) {
 #ifdef USERPROG
   exception_init();
   syscall_init();
+  process_init();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start();
   serial_init_queue();
+  if (async_console)
+    console_start_async();
+  boot_phase("startup");
   timer_calibrate();
+  boot_phase("calibrate");
 
 #ifdef FILESYS
-  /* Initialize file system. */
+  /* Initialize file system.  Unless it is to be formatted, it is
+     mounted when it is first used. */
   ide_init();
+  ramdisk_init();
+  boot_phase("probe");
   locate_block_devices();
+  if (load_ramdisk)
+    ramdisk_load(block_get_role(BLOCK_SCRATCH));
+  boot_phase("partitions");
   filesys_init(format_filesys);
+  boot_phase("filesys");
 #endif
 
+  print_boot_phases();
   printf("Boot complete.\n");
 
   /* Run actions specified on kernel command line. */
@@ -146,14 +186,37 @@ static void bss_init(void) {
   memset(&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU supports 4 MB pages, according to the
+   PSE feature flag reported by CPUID.  See [IA32-v2a] "CPUID". */
+static bool cpu_has_pse(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return (edx & (1 << 3)) != 0;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports them, each 4 MB region of RAM that does
+   not overlap the kernel's code is mapped with a single large
+   page, which saves page tables and TLB entries.  The kernel
+   code keeps 4 kB pages so that it can be mapped read-only. */
 static void paging_init(void) {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool use_large_pages = cpu_has_pse();
+
+  /* Enable 4 MB pages by setting the PSE bit in CR4.  See
+     [IA32-v3a] 3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+  if (use_large_pages) {
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+  }
 
   pd = init_page_dir = palloc_get_page(PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -164,6 +227,15 @@ static void paging_init(void) {
     size_t pte_idx = pt_no(vaddr);
     bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+    if (use_large_pages && pte_idx == 0 &&
+        init_ram_pages - page >= PTSPAN / PGSIZE &&
+        ((uintptr_t)vaddr >= (uintptr_t)&_end_kernel_text ||
+         (uintptr_t)vaddr + PTSPAN <= (uintptr_t)&_start)) {
+      pd[pde_idx] = pde_create_kernel_large(vaddr, true);
+      page += PTSPAN / PGSIZE - 1;
+      continue;
+    }
+
     if (pd[pde_idx] == 0) {
       pt = palloc_get_page(PAL_ASSERT | PAL_ZERO);
       pd[pde_idx] = pde_create(pt);
@@ -180,6 +252,31 @@ static void paging_init(void) {
   asm volatile("movl %0, %%cr3" : : "r"(vtop(init_page_dir)));
 }
 
+/* Ends the boot phase called NAME, which started when the
+   previous one ended.  The clock only starts once interrupts are
+   on, so time spent before thread_start() is not counted. */
+static void boot_phase(const char *name) {
+  int64_t now = timer_now_ns();
+  struct boot_phase *p;
+
+  ASSERT(boot_phase_cnt < BOOT_PHASE_CNT);
+  p = &boot_phases[boot_phase_cnt++];
+  p->name = name;
+  p->ns = now - boot_phase_start;
+  boot_phase_start = now;
+}
+
+/* Prints the time taken by each boot phase. */
+static void print_boot_phases(void) {
+  size_t i;
+
+  printf("Boot phases:");
+  for (i = 0; i < boot_phase_cnt; i++)
+    printf(" %s %" PRId64 " us%s", boot_phases[i].name,
+           boot_phases[i].ns / 1000, i + 1 < boot_phase_cnt ? "," : "");
+  printf("; total %" PRId64 " us.\n", boot_phase_start / 1000);
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **read_command_line(void) {
@@ -233,6 +330,13 @@ static char **parse_options(char **argv) {
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-cache"))
+      cache_size = atoi(value);
+    else if (!strcmp(name, "-ramdisk")) {
+      if (!ramdisk_configure(value))
+        PANIC("bad RAM disk size `%s' (use -h for help)", value);
+    } else if (!strcmp(name, "-ramdisk-load"))
+      load_ramdisk = true;
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -242,9 +346,16 @@ static char **parse_options(char **argv) {
       random_init(atoi(value));
     else if (!strcmp(name, "-mlfqs"))
       thread_mlfqs = true;
+    else if (!strcmp(name, "-async-log"))
+      async_console = true;
 #ifdef USERPROG
     else if (!strcmp(name, "-ul"))
       user_page_limit = atoi(value);
+    else if (!strcmp(name, "-limit")) {
+      if (value == NULL || !usage_set_limit(value))
+        PANIC("bad resource limit `%s' (use -h for help)", value);
+    } else if (!strcmp(name, "-acct"))
+      usage_report = true;
 #endif
     else
       PANIC("unknown option `%s' (use -h for help)", name);
@@ -289,6 +400,9 @@ static void run_actions(char **argv) {
   /* Table of supported actions. */
   static const struct action actions[] = {
       {"run", 2, run_task},
+#ifdef USERPROG
+      {"pingpong", 2, pingpong_bench},
+#endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -330,6 +444,7 @@ static void usage(void) {
          "\nAvailable actions:\n"
 #ifdef USERPROG
          "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
+         "  pingpong ITERS     Time switches between page directories.\n"
 #else
          "  run TEST           Run TEST.\n"
 #endif
@@ -349,14 +464,21 @@ static void usage(void) {
          "  -f                 Format file system device during startup.\n"
          "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
          "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+         "  -cache=SECTORS     Cache SECTORS sectors of the file system.\n"
+         "  -ramdisk=SIZE      Create RAM disk ram0 of SIZE bytes (K, M, G).\n"
+         "  -ramdisk-load      Copy the scratch device into ram0 at startup.\n"
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
          "  -rs=SEED           Set random number seed to SEED.\n"
          "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+         "  -async-log         Print console output from a thread.\n"
 #ifdef USERPROG
          "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+         "  -limit=RES:SOFT[:HARD]  Limit each process's use of RES,\n"
+         "                     one of cpu (ticks), files, or pages.\n"
+         "  -acct              Print each process's resource usage at exit.\n"
 #endif
          );
   shutdown_power_off();
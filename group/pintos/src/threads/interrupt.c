@@ -9,6 +9,10 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/usage.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -345,6 +349,13 @@ void intr_handler(struct intr_frame *frame) {
 
     if (yield_on_return)
       thread_yield();
+
+#ifdef USERPROG
+    /* Terminate a process that has run out of CPU time before
+       it returns to user mode. */
+    if (frame->cs == SEL_UCSEG)
+      usage_check_cpu();
+#endif
   }
 }
 
@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -38,6 +39,7 @@ static struct pool kernel_pool, user_pool;
 static void init_pool(struct pool *, void *base, size_t page_cnt,
                       const char *name);
 static bool page_from_pool(const struct pool *, void *page);
+static int compare_pages(const void *, const void *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -132,6 +134,22 @@ void palloc_free_multiple(void *pages, size_t page_cnt) {
 /* Frees the page at PAGE. */
 void palloc_free_page(void *page) { palloc_free_multiple(page, 1); }
 
+/* Frees the PAGE_CNT pages whose addresses are in PAGES[], which
+   need not be contiguous or in any particular order.  PAGES[]
+   is sorted in the process, so that each run of adjacent pages
+   can be freed at once. */
+void palloc_free_pages(void **pages, size_t page_cnt) {
+  size_t start, end;
+
+  qsort(pages, page_cnt, sizeof *pages, compare_pages);
+  for (start = 0; start < page_cnt; start = end) {
+    for (end = start + 1; end < page_cnt; end++)
+      if ((uint8_t *)pages[end] != (uint8_t *)pages[end - 1] + PGSIZE)
+        break;
+    palloc_free_multiple(pages[start], end - start);
+  }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void init_pool(struct pool *p, void *base, size_t page_cnt,
@@ -161,3 +179,12 @@ static bool page_from_pool(const struct pool *pool, void *page) {
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Compares the page addresses pointed to by A and B, for
+   qsort(). */
+static int compare_pages(const void *a_, const void *b_) {
+  const uint8_t *a = *(void *const *)a_;
+  const uint8_t *b = *(void *const *)b_;
+
+  return a < b ? -1 : a > b;
+}
@@ -301,3 +301,80 @@ void cond_broadcast(struct condition *cond, struct lock *lock) {
   while (!list_empty(&cond->waiters))
     cond_signal(cond, lock);
 }
+
+/* Initializes RWLOCK.  A readers-writer lock can be held by any
+   number of readers at once, or by a single writer.  Waiting
+   writers take priority over new readers, so that a steady
+   stream of readers cannot starve a writer. */
+void rwlock_init(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_init(&rwlock->lock);
+  cond_init(&rwlock->can_read);
+  cond_init(&rwlock->can_write);
+  rwlock->readers = 0;
+  rwlock->waiting_writers = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no thread holds it
+   for writing or is waiting to.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_read_acquire(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+  ASSERT(!intr_context());
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->writer != thread_current());
+  while (rwlock->writer != NULL || rwlock->waiting_writers > 0)
+    cond_wait(&rwlock->can_read, &rwlock->lock);
+  rwlock->readers++;
+  lock_release(&rwlock->lock);
+}
+
+/* Releases a read lock on RWLOCK held by the current thread. */
+void rwlock_read_release(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->readers > 0);
+  if (--rwlock->readers == 0)
+    cond_signal(&rwlock->can_write, &rwlock->lock);
+  lock_release(&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_write_acquire(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+  ASSERT(!intr_context());
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->writer != thread_current());
+  rwlock->waiting_writers++;
+  while (rwlock->writer != NULL || rwlock->readers > 0)
+    cond_wait(&rwlock->can_write, &rwlock->lock);
+  rwlock->waiting_writers--;
+  rwlock->writer = thread_current();
+  lock_release(&rwlock->lock);
+}
+
+/* Releases the write lock on RWLOCK, which must be held by the
+   current thread. */
+void rwlock_write_release(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->writer == thread_current());
+  rwlock->writer = NULL;
+  if (rwlock->waiting_writers > 0)
+    cond_signal(&rwlock->can_write, &rwlock->lock);
+  else
+    cond_broadcast(&rwlock->can_read, &rwlock->lock);
+  lock_release(&rwlock->lock);
+}
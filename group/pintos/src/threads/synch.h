@@ -38,6 +38,22 @@ void cond_wait(struct condition *, struct lock *);
 void cond_signal(struct condition *, struct lock *);
 void cond_broadcast(struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+  struct lock lock;            /* Protects the members below. */
+  struct condition can_read;   /* Signaled when readers may proceed. */
+  struct condition can_write;  /* Signaled when a writer may proceed. */
+  unsigned readers;            /* Number of threads holding read locks. */
+  unsigned waiting_writers;    /* Number of threads waiting to write. */
+  struct thread *writer;       /* Thread holding the write lock, if any. */
+};
+
+void rwlock_init(struct rwlock *);
+void rwlock_read_acquire(struct rwlock *);
+void rwlock_read_release(struct rwlock *);
+void rwlock_write_acquire(struct rwlock *);
+void rwlock_write_release(struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -14,6 +14,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/directory.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -118,19 +121,28 @@ void thread_start(void) {
   sema_down(&idle_started);
 }
 
-/* Called by the timer interrupt handler at each timer tick.
+/* Called by the timer interrupt handler at each timer tick, with
+   USER true if the tick interrupted user code.
    Thus, this function runs in an external interrupt context. */
-void thread_tick(void) {
+void thread_tick(bool user) {
   struct thread *t = thread_current();
 
+#ifndef USERPROG
+  /* Without user programs, every tick interrupts the kernel. */
+  (void)user;
+#endif
+
   /* Update statistics. */
   all_ticks++;
 
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
-  else if (t->pagedir != NULL)
+  else if (t->pagedir != NULL) {
     user_ticks++;
+    if (usage_tick(&t->usage, user))
+      intr_yield_on_return();
+  }
 #endif
   else
     kernel_ticks++;
@@ -179,6 +191,11 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
   /* Initialize thread. */
   init_thread(t, name, priority);
   tid = t->tid = allocate_tid();
+#ifdef FILESYS
+  /* Start out in the creator's current directory. */
+  if (thread_current()->cwd != NULL)
+    t->cwd = dir_reopen(thread_current()->cwd);
+#endif
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame(t, sizeof *kf);
@@ -6,6 +6,9 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#ifdef USERPROG
+#include "userprog/usage.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status {
@@ -99,7 +102,18 @@ struct thread {
 
 #ifdef USERPROG
   /* Owned by userprog/process.c. */
-  uint32_t *pagedir; /* Page directory. */
+  uint32_t *pagedir;  /* Page directory. */
+  struct usage usage; /* Resource usage and limits. */
+  struct list fds;    /* Open file descriptors. */
+  int next_fd;        /* Number for the next file descriptor. */
+#endif
+
+#ifdef FILESYS
+  /* Owned by filesys/filesys.c. */
+  struct dir *cwd; /* Current directory, or null for the root. */
+
+  /* Owned by filesys/log.c. */
+  int log_depth; /* Nesting depth of file system operations. */
 #endif
 
   /* Owned by thread.c. */
@@ -114,7 +128,7 @@ extern bool thread_mlfqs;
 void thread_init(void);
 void thread_start(void);
 
-void thread_tick(void);
+void thread_tick(bool user);
 void thread_print_stats(void);
 
 typedef void thread_func(void *aux);
@@ -1,14 +1,20 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
+static void load_pd (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
 
+/* Statistics. */
+static long long load_cnt;      /* # of times CR3 was loaded. */
+static long long skip_cnt;      /* # of loads skipped as redundant. */
+
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
@@ -23,7 +29,8 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  The pages mapped by each page table are freed
+   together, in runs of adjacent pages, rather than one by one. */
 void
 pagedir_destroy (uint32_t *pd)
 {
@@ -37,11 +44,17 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P)
       {
         uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
+        void **pages = (void **) pt;
+        size_t page_cnt = 0;
+        size_t i;
 
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P)
-            palloc_free_page (pte_get_page (*pte));
+        /* Collect the pages, reusing the page table itself as the
+           array since nothing will read its entries again.  Slot
+           PAGE_CNT is never past entry I, which is already read. */
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          if (pt[i] & PTE_P)
+            pages[page_cnt++] = pte_get_page (pt[i]);
+        palloc_free_pages (pages, page_cnt);
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -167,6 +180,15 @@ pagedir_is_dirty (uint32_t *pd, const void *vpage)
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
+/* Returns true if virtual page VPAGE is mapped in PD and user
+   code may write to it, false otherwise. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
    in PD. */
 void
@@ -215,13 +237,26 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded.  Reloading CR3 flushes
+   the TLB, so this is worth avoiding. */
 void
 pagedir_activate (uint32_t *pd)
 {
   if (pd == NULL)
     pd = init_page_dir;
 
+  if (pd == active_pd ())
+    skip_cnt++;
+  else
+    load_pd (pd);
+}
+
+/* Loads PD into CR3 unconditionally. */
+static void
+load_pd (uint32_t *pd)
+{
+  load_cnt++;
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -230,6 +265,14 @@ pagedir_activate (uint32_t *pd)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
+/* Prints page directory statistics. */
+void
+pagedir_print_stats (void)
+{
+  printf ("Paging: %lld page directory loads, %lld skipped\n",
+          load_cnt, skip_cnt);
+}
+
 /* Returns the currently active page directory. */
 static uint32_t *
 active_pd (void)
@@ -256,8 +299,8 @@ invalidate_pagedir (uint32_t *pd)
 {
   if (active_pd () == pd)
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Re-loading PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pd (pd);
     }
 }
@@ -0,0 +1,123 @@
+#include "userprog/pingpong.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Context-switch benchmark.
+
+   Two kernel threads take turns, each activating its own page
+   directory and touching a few pages of kernel memory before
+   handing off to the other.  When both use the same page
+   directory, pagedir_activate() skips the reload and the touched
+   pages stay in the TLB; when they use different ones, every
+   turn reloads CR3 and misses in the TLB again. */
+
+/* Pages touched on each turn. */
+#define PINGPONG_PAGES 16
+
+/* State shared by the two benchmark threads. */
+struct pingpong
+  {
+    uint32_t *pd[2];            /* Page directory of each thread. */
+    struct semaphore turn[2];   /* Up'd to give a thread its turn. */
+    uint8_t *pages;             /* PINGPONG_PAGES pages to touch. */
+    int iters;                  /* Number of round trips. */
+  };
+
+static thread_func pingpong_thread;
+static int64_t pingpong_run (struct pingpong *);
+
+/* Runs the benchmark for the number of round trips given in
+   ARGV[1], first with one page directory and then with two, and
+   prints the time per round trip of each. */
+void
+pingpong_bench (char **argv)
+{
+  struct pingpong pp;
+  int64_t same, different;
+
+  pp.iters = atoi (argv[1]);
+  if (pp.iters <= 0)
+    {
+      printf ("pingpong: ITERS must be positive\n");
+      return;
+    }
+  pp.pages = palloc_get_multiple (PAL_ASSERT, PINGPONG_PAGES);
+  pp.pd[0] = pp.pd[1] = pagedir_create ();
+  if (pp.pd[0] == NULL)
+    PANIC ("pingpong: out of memory");
+
+  same = pingpong_run (&pp);
+  pp.pd[1] = pagedir_create ();
+  if (pp.pd[1] == NULL)
+    PANIC ("pingpong: out of memory");
+  different = pingpong_run (&pp);
+
+  printf ("pingpong: %d round trips, %'lld ns each with one page "
+          "directory, %'lld ns with two\n",
+          pp.iters, same / pp.iters, different / pp.iters);
+
+  pagedir_activate (NULL);
+  pagedir_destroy (pp.pd[0]);
+  pagedir_destroy (pp.pd[1]);
+  palloc_free_multiple (pp.pages, PINGPONG_PAGES);
+}
+
+/* Touches one byte in each page of PP's pages. */
+static void
+pingpong_touch (struct pingpong *pp)
+{
+  volatile uint8_t *p = pp->pages;
+  size_t i;
+
+  for (i = 0; i < PINGPONG_PAGES; i++)
+    p[i * PGSIZE]++;
+}
+
+/* Plays PP->iters round trips between the running thread, on
+   PP->pd[0], and a new thread on PP->pd[1].  Returns the elapsed
+   time in nanoseconds. */
+static int64_t
+pingpong_run (struct pingpong *pp)
+{
+  int64_t start;
+  int i;
+
+  sema_init (&pp->turn[0], 0);
+  sema_init (&pp->turn[1], 0);
+  if (thread_create ("pingpong", PRI_DEFAULT, pingpong_thread, pp)
+      == TID_ERROR)
+    PANIC ("pingpong: thread creation failed");
+
+  start = timer_now_ns ();
+  for (i = 0; i < pp->iters; i++)
+    {
+      pagedir_activate (pp->pd[0]);
+      pingpong_touch (pp);
+      sema_up (&pp->turn[1]);
+      sema_down (&pp->turn[0]);
+    }
+  return timer_now_ns () - start;
+}
+
+/* The other side of pingpong_run(). */
+static void
+pingpong_thread (void *pp_)
+{
+  struct pingpong *pp = pp_;
+  int i;
+
+  for (i = 0; i < pp->iters; i++)
+    {
+      sema_down (&pp->turn[1]);
+      pagedir_activate (pp->pd[1]);
+      pingpong_touch (pp);
+      sema_up (&pp->turn[0]);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef USERPROG_PINGPONG_H
+#define USERPROG_PINGPONG_H
+
+void pingpong_bench (char **argv);
+
+#endif /* userprog/pingpong.h */
@@ -7,21 +7,49 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/usage.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
 static struct semaphore temporary;
+
+/* Maximum number of images kept in the exec cache. */
+#define EXEC_CACHE_SIZE 16
+
+/* Recently loaded executable images, most recently used first.
+   Test harnesses and shells exec the same few programs over and
+   over, so this saves re-reading and re-validating their headers
+   on every exec.  An entry is dropped as soon as its inode is
+   written or removed (see process_image_invalidate()). */
+static struct list exec_cache;
+static struct lock exec_cache_lock;
+
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool load (const char *file_name, size_t stack_size,
+                  void (**eip) (void), void **esp);
+static size_t args_size (size_t cmd_len);
+static bool push_args (const char *cmd_line, size_t cmd_len,
+                       const char *file_name, char *save_ptr, void **esp);
+
+/* Initializes the user process module. */
+void
+process_init (void)
+{
+  list_init (&exec_cache);
+  lock_init (&exec_cache_lock);
+}
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -31,6 +59,8 @@ tid_t
 process_execute (const char *file_name)
 {
   char *fn_copy;
+  char name[16];
+  size_t name_len;
   tid_t tid;
 
   sema_init (&temporary, 0);
@@ -41,31 +71,49 @@ process_execute (const char *file_name)
     return TID_ERROR;
   strlcpy (fn_copy, file_name, PGSIZE);
 
+  /* Name the thread after the program, the first word of
+     FILE_NAME. */
+  file_name += strspn (file_name, " ");
+  name_len = strcspn (file_name, " ");
+  strlcpy (name, file_name,
+           name_len < sizeof name ? name_len + 1 : sizeof name);
+
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create (name, PRI_DEFAULT, start_process, fn_copy);
   if (tid == TID_ERROR)
     palloc_free_page (fn_copy);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
-   running. */
+   running.  CMD_LINE_ is the program name followed by its
+   arguments, separated by spaces. */
 static void
-start_process (void *file_name_)
+start_process (void *cmd_line_)
 {
-  char *file_name = file_name_;
+  char *cmd_line = cmd_line_;
+  size_t cmd_len = strlen (cmd_line);
+  char *file_name, *save_ptr;
   struct intr_frame if_;
   bool success;
 
-  /* Initialize interrupt frame and load executable. */
+  /* Start accounting, then initialize interrupt frame and load
+     executable. */
+  usage_start (&thread_current ()->usage);
+  list_init (&thread_current ()->fds);
+  thread_current ()->next_fd = 2;
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  file_name = strtok_r (cmd_line, " ", &save_ptr);
+  success = (file_name != NULL
+             && load (file_name, args_size (cmd_len), &if_.eip, &if_.esp)
+             && push_args (cmd_line, cmd_len, file_name, save_ptr,
+                           &if_.esp));
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
+  palloc_free_page (cmd_line);
   if (!success)
     thread_exit ();
 
@@ -114,10 +162,15 @@ process_exit (void)
          directory before destroying the process's page
          directory, or our active page directory will be one
          that's been freed (and cleared). */
+      if (usage_report)
+        usage_print (cur->name, &cur->usage);
+      syscall_exit ();
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
   sema_up (&temporary);
 }
 
@@ -129,8 +182,13 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has no user
+     address space, and every page directory has the same kernel
+     mappings, so it keeps whichever page directory is loaded
+     instead of flushing the TLB.  process_exit() switches to the
+     base page directory explicitly before destroying its own. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -200,7 +258,36 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+/* A loadable segment, already validated against its file and
+   reduced to the arguments load_segment() needs. */
+struct exec_segment
+  {
+    off_t ofs;                  /* Page-aligned offset in file. */
+    uint8_t *upage;             /* Page-aligned user virtual address. */
+    uint32_t read_bytes;        /* Bytes to read from file. */
+    uint32_t zero_bytes;        /* Bytes to zero after READ_BYTES. */
+    bool writable;              /* Map the pages writable? */
+  };
+
+/* A parsed executable image: the result of reading and
+   validating the ELF header and program headers of a file. */
+struct exec_image
+  {
+    struct list_elem elem;      /* Element in exec_cache. */
+    block_sector_t inumber;     /* Inode number of the executable. */
+    int ref_cnt;                /* Cache reference plus loaders. */
+    Elf32_Addr entry;           /* Entry point. */
+    size_t segment_cnt;         /* Number of elements in SEGMENTS. */
+    struct exec_segment *segments;  /* Loadable segments. */
+  };
+
+static struct exec_image *read_image (struct file *, const char *file_name);
+static struct exec_image *exec_cache_lookup (block_sector_t inumber);
+static struct exec_image *exec_cache_insert (struct exec_image *,
+                                             struct inode *);
+static void exec_image_release (struct exec_image *);
+
+static bool setup_stack (void **esp, size_t size);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
@@ -208,17 +295,18 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 /* Loads an ELF executable from FILE_NAME into the current thread.
    Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
+   and its initial stack pointer into *ESP.  The stack has room
+   for at least STACK_SIZE bytes of arguments.
    Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp)
+static bool
+load (const char *file_name, size_t stack_size,
+      void (**eip) (void), void **esp)
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *image = NULL;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
-  int i;
+  size_t i;
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
@@ -226,13 +314,63 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
-  /* Open executable file. */
+  /* Open executable file.  Writes are denied while we load so
+     that the image we read or cache cannot change under us. */
   file = filesys_open (file_name);
   if (file == NULL)
     {
       printf ("load: %s: open failed\n", file_name);
       goto done;
     }
+  file_deny_write (file);
+
+  /* Find the parsed headers in the cache, or read them. */
+  image = exec_cache_lookup (inode_get_inumber (file_get_inode (file)));
+  if (image == NULL)
+    {
+      image = read_image (file, file_name);
+      if (image == NULL)
+        goto done;
+      image = exec_cache_insert (image, file_get_inode (file));
+    }
+
+  /* Load segments. */
+  for (i = 0; i < image->segment_cnt; i++)
+    {
+      const struct exec_segment *seg = &image->segments[i];
+      if (!load_segment (file, seg->ofs, seg->upage,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+    }
+
+  /* Set up stack. */
+  if (!setup_stack (esp, stack_size))
+    goto done;
+
+  /* Start address. */
+  *eip = (void (*) (void)) image->entry;
+
+  success = true;
+
+ done:
+  /* We arrive here whether the load is successful or not. */
+  if (image != NULL)
+    exec_image_release (image);
+  file_close (file);
+  return success;
+}
+
+/* Reads and verifies the executable header and program headers
+   of FILE, named FILE_NAME, and returns a new image holding a
+   reference for the caller.  Returns a null pointer if FILE is
+   not a valid executable or if memory allocation fails. */
+static struct exec_image *
+read_image (struct file *file, const char *file_name)
+{
+  struct Elf32_Ehdr ehdr;
+  struct exec_image *image;
+  off_t file_ofs;
+  int i;
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -244,9 +382,22 @@ load (const char *file_name, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024)
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done;
+      return NULL;
     }
 
+  /* Allocate image, with room for every program header to be a
+     loadable segment. */
+  image = malloc (sizeof *image);
+  if (image == NULL)
+    return NULL;
+  image->inumber = inode_get_inumber (file_get_inode (file));
+  image->ref_cnt = 1;
+  image->entry = ehdr.e_entry;
+  image->segment_cnt = 0;
+  image->segments = malloc (ehdr.e_phnum * sizeof *image->segments);
+  if (image->segments == NULL && ehdr.e_phnum > 0)
+    goto error;
+
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++)
@@ -254,11 +405,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        goto error;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        goto error;
       file_ofs += sizeof phdr;
       switch (phdr.p_type)
         {
@@ -272,58 +423,165 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto error;
         case PT_LOAD:
           if (validate_segment (&phdr, file))
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct exec_segment *seg;
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+
+              seg = &image->segments[image->segment_cnt++];
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->ofs = phdr.p_offset & ~PGMASK;
+              seg->upage = (uint8_t *) (phdr.p_vaddr & ~PGMASK);
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            goto error;
           break;
         }
     }
+  return image;
 
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
+ error:
+  free (image->segments);
+  free (image);
+  return NULL;
+}
 
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+/* Returns the cached image for the executable with inode number
+   INUMBER, with a new reference held for the caller, or a null
+   pointer if it is not cached. */
+static struct exec_image *
+exec_cache_lookup (block_sector_t inumber)
+{
+  struct list_elem *e;
 
-  success = true;
+  lock_acquire (&exec_cache_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
+       e = list_next (e))
+    {
+      struct exec_image *image = list_entry (e, struct exec_image, elem);
+      if (image->inumber == inumber)
+        {
+          /* Move to front to keep the list in LRU order. */
+          list_remove (&image->elem);
+          list_push_front (&exec_cache, &image->elem);
+          image->ref_cnt++;
+          lock_release (&exec_cache_lock);
+          return image;
+        }
+    }
+  lock_release (&exec_cache_lock);
+  return NULL;
+}
 
- done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
-  return success;
+/* Adds IMAGE, read from INODE, to which the caller holds a
+   reference, to the exec cache, evicting the least recently used
+   image if the cache is full.  If another thread cached the same
+   executable first, releases IMAGE and returns that one instead.
+   Either way, the caller holds a reference to the returned image.
+
+   IMAGE is not cached if INODE was removed while it was being
+   read, because process_image_invalidate() has already run for
+   it and its sector may later hold a different executable. */
+static struct exec_image *
+exec_cache_insert (struct exec_image *image, struct inode *inode)
+{
+  struct exec_image *victim = NULL;
+  struct exec_image *other;
+
+  other = exec_cache_lookup (image->inumber);
+  if (other != NULL)
+    {
+      exec_image_release (image);
+      return other;
+    }
+
+  lock_acquire (&exec_cache_lock);
+  if (inode_is_removed (inode))
+    {
+      lock_release (&exec_cache_lock);
+      return image;
+    }
+  inode_set_exec_cached (inode);
+  if (list_size (&exec_cache) >= EXEC_CACHE_SIZE)
+    victim = list_entry (list_pop_back (&exec_cache),
+                         struct exec_image, elem);
+  image->ref_cnt++;
+  list_push_front (&exec_cache, &image->elem);
+  lock_release (&exec_cache_lock);
+
+  if (victim != NULL)
+    exec_image_release (victim);
+  return image;
+}
+
+/* Drops a reference to IMAGE, freeing it if it was the last. */
+static void
+exec_image_release (struct exec_image *image)
+{
+  bool last;
+
+  lock_acquire (&exec_cache_lock);
+  last = --image->ref_cnt == 0;
+  lock_release (&exec_cache_lock);
+
+  if (last)
+    {
+      free (image->segments);
+      free (image);
+    }
+}
+
+/* Drops the cached image, if any, for the executable with inode
+   number INUMBER.  Called by the file system whenever that inode
+   is written or removed. */
+void
+process_image_invalidate (block_sector_t inumber)
+{
+  struct exec_image *victim = NULL;
+  struct list_elem *e;
+
+  lock_acquire (&exec_cache_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
+       e = list_next (e))
+    {
+      struct exec_image *image = list_entry (e, struct exec_image, elem);
+      if (image->inumber == inumber)
+        {
+          list_remove (&image->elem);
+          victim = image;
+          break;
+        }
+    }
+  lock_release (&exec_cache_lock);
+
+  if (victim != NULL)
+    exec_image_release (victim);
 }
 
 /* load() helpers. */
 
 static bool install_page (void *upage, void *kpage, bool writable);
+static void *get_user_page (enum palloc_flags);
+static void free_user_page (void *kpage);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -402,22 +660,23 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
       /* Get a page of memory. */
-      uint8_t *kpage = palloc_get_page (PAL_USER);
+      uint8_t *kpage = get_user_page (0);
       if (kpage == NULL)
         return false;
 
       /* Load this page. */
       if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
         {
-          palloc_free_page (kpage);
+          free_user_page (kpage);
           return false;
         }
       memset (kpage + page_read_bytes, 0, page_zero_bytes);
+      thread_current ()->usage.bytes_read += page_read_bytes;
 
       /* Add the page to the process's address space. */
       if (!install_page (upage, kpage, writable))
         {
-          palloc_free_page (kpage);
+          free_user_page (kpage);
           return false;
         }
 
@@ -429,24 +688,105 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+/* Create a minimal stack by mapping zeroed pages at the top of
+   user virtual memory, enough to hold SIZE bytes of arguments
+   (at least one page). */
 static bool
-setup_stack (void **esp)
+setup_stack (void **esp, size_t size)
 {
-  uint8_t *kpage;
-  bool success = false;
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  uint8_t *upage = PHYS_BASE;
+  size_t i;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL)
+  if (page_cnt == 0)
+    page_cnt = 1;
+  for (i = 0; i < page_cnt; i++)
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
-        palloc_free_page (kpage);
+      uint8_t *kpage = get_user_page (PAL_ZERO);
+      upage -= PGSIZE;
+      if (kpage == NULL)
+        return false;
+      if (!install_page (upage, kpage, true))
+        {
+          free_user_page (kpage);
+          return false;
+        }
     }
-  return success;
+  *esp = PHYS_BASE;
+  return true;
+}
+
+/* Returns an upper bound on the number of bytes of stack that
+   push_args() needs for a command line CMD_LEN bytes long. */
+static size_t
+args_size (size_t cmd_len)
+{
+  /* Every argument takes at least two bytes of the command line,
+     one for a character and one for a separator. */
+  size_t max_argc = (cmd_len + 1) / 2;
+
+  return (ROUND_UP (cmd_len + 1, sizeof (char *))  /* Strings. */
+          + (max_argc + 1) * sizeof (char *)        /* argv[]. */
+          + sizeof (char **)                        /* argv. */
+          + sizeof (int)                            /* argc. */
+          + sizeof (void *));                       /* Return address. */
+}
+
+/* Lays out the command-line arguments for main() on the new
+   process's stack, which must be mapped and active, and updates
+   *ESP to point to the fake return address below them.
+
+   CMD_LINE, CMD_LEN bytes long, has already been passed once to
+   strtok_r(), which returned FILE_NAME and left SAVE_PTR
+   pointing at the remaining arguments.  The command line is
+   copied to the top of the stack and tokenized there in place,
+   so each argument is written exactly once, and argv[] is built
+   downward as the tokens are found and then reversed.  Returns
+   false if the arguments overflow args_size (CMD_LEN) bytes,
+   which should not happen. */
+static bool
+push_args (const char *cmd_line, size_t cmd_len, const char *file_name,
+           char *save_ptr, void **esp)
+{
+  uint8_t *limit = (uint8_t *) *esp - args_size (cmd_len);
+  char *strings = (char *) *esp - (cmd_len + 1);
+  char **argv, **lo, **hi, **sp;
+  char *token;
+  int argc = 0;
+
+  /* Copy the command line, including the null terminator that
+     strtok_r() already placed after FILE_NAME, and follow it
+     with argv[argc], a null pointer. */
+  memcpy (strings, cmd_line, cmd_len + 1);
+  argv = (char **) ROUND_DOWN ((uintptr_t) strings, sizeof (char *));
+  *--argv = NULL;
+
+  /* Push a pointer to each argument, last one at the bottom. */
+  save_ptr = strings + (save_ptr - cmd_line);
+  for (token = strings + (file_name - cmd_line); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    {
+      if ((uint8_t *) (argv - 1) < limit)
+        return false;
+      *--argv = token;
+      argc++;
+    }
+
+  /* Reverse so that argv[0] is at the bottom. */
+  for (lo = argv, hi = argv + argc - 1; lo < hi; lo++, hi--)
+    {
+      char *tmp = *lo;
+      *lo = *hi;
+      *hi = tmp;
+    }
+
+  /* Push argv, argc, and a fake return address. */
+  sp = argv;
+  *--sp = (char *) argv;
+  *(int *) --sp = argc;
+  *--sp = NULL;
+  *esp = sp;
+  return true;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -468,3 +808,30 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+
+/* Allocates a page from the user pool with the given FLAGS and
+   charges it to the running process.  Returns a null pointer if
+   that would exceed the process's page limit or if no page is
+   available. */
+static void *
+get_user_page (enum palloc_flags flags)
+{
+  void *kpage;
+
+  if (!usage_charge (USAGE_PAGES, 1))
+    return NULL;
+  kpage = palloc_get_page (PAL_USER | flags);
+  if (kpage == NULL)
+    usage_uncharge (USAGE_PAGES, 1);
+  return kpage;
+}
+
+/* Frees KPAGE, obtained with get_user_page(), before it has been
+   installed in the page table.  Installed pages are freed along
+   with the page directory when the process exits. */
+static void
+free_user_page (void *kpage)
+{
+  palloc_free_page (kpage);
+  usage_uncharge (USAGE_PAGES, 1);
+}
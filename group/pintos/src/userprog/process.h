@@ -1,11 +1,14 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "devices/block.h"
 #include "threads/thread.h"
 
+void process_init (void);
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+void process_image_invalidate (block_sector_t inumber);
 
 #endif /* userprog/process.h */
@@ -1,10 +1,41 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <list.h>
 #include <syscall-nr.h>
+#include <time.h>
+#include "devices/block.h"
+#include "devices/input.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/usage.h"
+
+/* An open file descriptor. */
+struct fd
+  {
+    int fd;                     /* File descriptor number. */
+    struct file *file;          /* Open file. */
+    struct dir *dir;            /* Open directory, if FILE is one. */
+    struct list_elem elem;      /* Element in thread's `fds' list. */
+  };
 
 static void syscall_handler (struct intr_frame *);
+static bool check_user (const void *uaddr, size_t size, bool write);
+static bool check_user_string (const char *ustr);
+static int sys_open (const char *name);
+static int sys_read (int fd_no, void *buffer, unsigned size);
+static int sys_write (int fd_no, const void *buffer, unsigned size);
+static struct fd *lookup_fd (int fd);
+static void close_fd (struct fd *);
+static bool sys_iostat (int dev, struct iostat *);
+static int sys_clock_gettime (int clock, struct timespec *);
 
 void
 syscall_init (void)
@@ -12,14 +43,269 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Closes all of the running process's file descriptors. */
+void
+syscall_exit (void)
+{
+  struct list *fds = &thread_current ()->fds;
+
+  while (!list_empty (fds))
+    close_fd (list_entry (list_front (fds), struct fd, elem));
+}
+
 static void
 syscall_handler (struct intr_frame *f UNUSED)
 {
   uint32_t* args = ((uint32_t*) f->esp);
+  struct fd *fd;
+  thread_current ()->usage.syscalls++;
+  usage_check_cpu ();
   printf("System call number: %d\n", args[0]);
   if (args[0] == SYS_EXIT) {
     f->eax = args[1];
     printf("%s: exit(%d)\n", &thread_current ()->name, args[1]);
     thread_exit();
   }
+  else if (args[0] == SYS_OPEN)
+    f->eax = sys_open ((const char *) args[1]);
+  else if (args[0] == SYS_CLOSE)
+    {
+      fd = lookup_fd (args[1]);
+      if (fd != NULL)
+        close_fd (fd);
+    }
+  else if (args[0] == SYS_READ)
+    f->eax = sys_read (args[1], (void *) args[2], args[3]);
+  else if (args[0] == SYS_WRITE)
+    f->eax = sys_write (args[1], (const void *) args[2], args[3]);
+  else if (args[0] == SYS_CHDIR)
+    f->eax = (check_user_string ((const char *) args[1])
+              && filesys_chdir ((const char *) args[1]));
+  else if (args[0] == SYS_MKDIR)
+    f->eax = (check_user_string ((const char *) args[1])
+              && filesys_mkdir ((const char *) args[1]));
+  else if (args[0] == SYS_READDIR)
+    {
+      fd = lookup_fd (args[1]);
+      f->eax = (fd != NULL && fd->dir != NULL
+                && check_user ((char *) args[2], NAME_MAX + 1, true)
+                && dir_readdir (fd->dir, (char *) args[2]));
+    }
+  else if (args[0] == SYS_ISDIR)
+    {
+      fd = lookup_fd (args[1]);
+      f->eax = fd != NULL && fd->dir != NULL;
+    }
+  else if (args[0] == SYS_INUMBER)
+    {
+      fd = lookup_fd (args[1]);
+      f->eax = (fd != NULL
+                ? (int) inode_get_inumber (file_get_inode (fd->file))
+                : -1);
+    }
+  else if (args[0] == SYS_IOSTAT)
+    f->eax = sys_iostat (args[1], (struct iostat *) args[2]);
+  else if (args[0] == SYS_CLOCK_GETTIME)
+    f->eax = sys_clock_gettime (args[1], (struct timespec *) args[2]);
+}
+
+/* Opens the file or directory NAME and returns a new file
+   descriptor for it, or -1 on failure or if NAME is not a valid
+   user string. */
+static int
+sys_open (const char *name)
+{
+  struct thread *t = thread_current ();
+  struct fd *fd;
+  struct inode *inode;
+
+  if (!check_user_string (name) || !usage_charge (USAGE_FILES, 1))
+    return -1;
+  fd = malloc (sizeof *fd);
+  if (fd == NULL)
+    {
+      usage_uncharge (USAGE_FILES, 1);
+      return -1;
+    }
+  fd->file = filesys_open (name);
+  if (fd->file == NULL)
+    {
+      free (fd);
+      usage_uncharge (USAGE_FILES, 1);
+      return -1;
+    }
+  fd->dir = NULL;
+  inode = file_get_inode (fd->file);
+  if (inode_is_dir (inode))
+    {
+      fd->dir = dir_open (inode_reopen (inode));
+      if (fd->dir == NULL)
+        {
+          file_close (fd->file);
+          free (fd);
+          usage_uncharge (USAGE_FILES, 1);
+          return -1;
+        }
+    }
+  fd->fd = t->next_fd++;
+  list_push_back (&t->fds, &fd->elem);
+  return fd->fd;
+}
+
+/* Reads up to SIZE bytes from file descriptor FD_NO into BUFFER.
+   For STDIN_FILENO, waits for at least one key and returns
+   whatever has been typed, without waiting for SIZE bytes.
+   Returns the number of bytes read, or -1 if FD_NO is not open
+   for reading or BUFFER is not valid. */
+static int
+sys_read (int fd_no, void *buffer, unsigned size)
+{
+  struct fd *fd;
+  off_t bytes_read;
+
+  if (!check_user (buffer, size, true))
+    return -1;
+  if (fd_no == STDIN_FILENO)
+    return input_read (buffer, size);
+  fd = lookup_fd (fd_no);
+  if (fd == NULL || fd->dir != NULL)
+    return -1;
+  bytes_read = file_read (fd->file, buffer, size);
+  thread_current ()->usage.bytes_read += bytes_read;
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER to file descriptor FD_NO, which may
+   be STDOUT_FILENO for the console.  Returns the number of bytes
+   written, or -1 if FD_NO is not open for writing or BUFFER is not
+   valid. */
+static int
+sys_write (int fd_no, const void *buffer, unsigned size)
+{
+  struct fd *fd;
+  off_t bytes_written;
+
+  if (!check_user (buffer, size, false))
+    return -1;
+  if (fd_no == STDOUT_FILENO)
+    {
+      putbuf (buffer, size);
+      return size;
+    }
+  fd = lookup_fd (fd_no);
+  if (fd == NULL || fd->dir != NULL)
+    return -1;
+  bytes_written = file_write (fd->file, buffer, size);
+  thread_current ()->usage.bytes_written += bytes_written;
+  return bytes_written;
+}
+
+/* Returns the running process's file descriptor numbered FD, or
+   a null pointer if it has none by that number. */
+static struct fd *
+lookup_fd (int fd)
+{
+  struct list *fds = &thread_current ()->fds;
+  struct list_elem *e;
+
+  for (e = list_begin (fds); e != list_end (fds); e = list_next (e))
+    {
+      struct fd *f = list_entry (e, struct fd, elem);
+      if (f->fd == fd)
+        return f;
+    }
+  return NULL;
+}
+
+/* Closes file descriptor FD and frees it. */
+static void
+close_fd (struct fd *fd)
+{
+  list_remove (&fd->elem);
+  dir_close (fd->dir);
+  file_close (fd->file);
+  free (fd);
+  usage_uncharge (USAGE_FILES, 1);
+}
+
+/* Returns true if the SIZE bytes starting at user address UADDR
+   are all mapped in the running process, and writable by it if
+   WRITE is true.  Must be checked before the kernel touches user
+   memory, which would otherwise let a process read or write any
+   kernel address. */
+static bool
+check_user (const void *uaddr, size_t size, bool write)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *start = uaddr;
+  const uint8_t *last = start + size - 1;
+  const uint8_t *page;
+
+  if (size == 0)
+    return true;
+  if (last < start || !is_user_vaddr (last))
+    return false;
+  for (page = pg_round_down (start); page <= last; page += PGSIZE)
+    if (write
+        ? !pagedir_is_writable (pd, page)
+        : pagedir_get_page (pd, page) == NULL)
+      return false;
+  return true;
+}
+
+/* Returns true if the null-terminated string at user address
+   USTR is entirely mapped in the running process.  Checks one
+   page at a time, up to the page that holds the null
+   terminator. */
+static bool
+check_user_string (const char *ustr)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const char *p = ustr;
+
+  for (;;)
+    {
+      const char *page_end = (const char *) pg_round_down (p) + PGSIZE;
+
+      if (!is_user_vaddr (p) || pagedir_get_page (pd, p) == NULL)
+        return false;
+      for (; p < page_end; p++)
+        if (*p == '\0')
+          return true;
+    }
+}
+
+/* Copies the statistics for block device number DEV, counting
+   from 0 in probe order, into *STATS.  Returns false if there is
+   no such device or STATS is not valid. */
+static bool
+sys_iostat (int dev, struct iostat *stats)
+{
+  struct block *block;
+
+  if (dev < 0 || !check_user (stats, sizeof *stats, true))
+    return false;
+  for (block = block_first (); block != NULL; block = block_next (block))
+    if (dev-- == 0)
+      {
+        block_get_stats (block, stats);
+        return true;
+      }
+  return false;
+}
+
+/* Stores the current time on CLOCK into *TS.  Returns 0 if
+   successful, -1 if CLOCK is not a supported clock or TS is not
+   a writable user address. */
+static int
+sys_clock_gettime (int clock, struct timespec *ts)
+{
+  int64_t now;
+
+  if (clock != CLOCK_MONOTONIC || !check_user (ts, sizeof *ts, true))
+    return -1;
+  now = timer_now_ns ();
+  ts->tv_sec = now / 1000000000;
+  ts->tv_nsec = now % 1000000000;
+  return 0;
 }
@@ -0,0 +1,175 @@
+#include "userprog/usage.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Limits given to each new process, set by the kernel
+   command-line option "-limit". */
+static struct usage_limit default_limits[USAGE_CNT];
+
+/* Names of resources, as used by "-limit" and in messages. */
+static const char *resource_names[USAGE_CNT] = {"cpu", "files", "pages"};
+
+bool usage_report;
+
+static int64_t usage_of (const struct usage *, enum usage_resource);
+static void warn_soft_limit (struct usage *, enum usage_resource);
+
+/* Sets the default limits for one resource from SPEC, which has
+   the form RESOURCE:SOFT[:HARD].  If HARD is omitted, it is the
+   same as SOFT.  Returns true if successful, false if SPEC is
+   malformed. */
+bool
+usage_set_limit (char *spec)
+{
+  char *save_ptr;
+  char *name = strtok_r (spec, ":", &save_ptr);
+  char *soft = strtok_r (NULL, ":", &save_ptr);
+  char *hard = strtok_r (NULL, ":", &save_ptr);
+  int i;
+
+  if (name == NULL || soft == NULL)
+    return false;
+  for (i = 0; i < USAGE_CNT; i++)
+    if (!strcmp (name, resource_names[i]))
+      {
+        default_limits[i].soft = atoi (soft);
+        default_limits[i].hard = hard != NULL ? atoi (hard) : atoi (soft);
+        return true;
+      }
+  return false;
+}
+
+/* Initializes U for a new process, with the default limits. */
+void
+usage_start (struct usage *u)
+{
+  memset (u, 0, sizeof *u);
+  memcpy (u->limits, default_limits, sizeof u->limits);
+}
+
+/* Charges a timer tick to U, in user mode if USER is true,
+   otherwise in the kernel.  Returns true if the process has
+   now used up its CPU time, in which case it should be
+   preempted so that usage_check_cpu() can terminate it.
+
+   Runs in the timer interrupt handler. */
+bool
+usage_tick (struct usage *u, bool user)
+{
+  int64_t hard = u->limits[USAGE_CPU].hard;
+
+  ASSERT (intr_context ());
+
+  if (user)
+    u->user_ticks++;
+  else
+    u->kernel_ticks++;
+  return hard > 0 && usage_of (u, USAGE_CPU) > hard;
+}
+
+/* Charges AMOUNT units of RESOURCE to the running process.
+   Returns true if successful, false if that would take the
+   process over its hard limit, in which case nothing is
+   charged.  Call this before allocating the resource. */
+bool
+usage_charge (enum usage_resource resource, int64_t amount)
+{
+  struct usage *u = &thread_current ()->usage;
+  int64_t hard = u->limits[resource].hard;
+
+  ASSERT (resource != USAGE_CPU);
+
+  if (hard > 0 && usage_of (u, resource) + amount > hard)
+    return false;
+  if (resource == USAGE_FILES)
+    u->open_files += amount;
+  else
+    u->pages += amount;
+  warn_soft_limit (u, resource);
+  return true;
+}
+
+/* Returns AMOUNT units of RESOURCE, previously charged with
+   usage_charge(), from the running process. */
+void
+usage_uncharge (enum usage_resource resource, int64_t amount)
+{
+  struct usage *u = &thread_current ()->usage;
+
+  ASSERT (resource != USAGE_CPU);
+  ASSERT (usage_of (u, resource) >= amount);
+
+  if (resource == USAGE_FILES)
+    u->open_files -= amount;
+  else
+    u->pages -= amount;
+}
+
+/* Terminates the running process if it has used more CPU time
+   than its hard limit allows.  Called on the way back to user
+   mode, where it is safe to exit. */
+void
+usage_check_cpu (void)
+{
+  struct thread *t = thread_current ();
+  struct usage *u = &t->usage;
+  int64_t hard = u->limits[USAGE_CPU].hard;
+
+  ASSERT (!intr_context ());
+
+  warn_soft_limit (u, USAGE_CPU);
+  if (hard > 0 && usage_of (u, USAGE_CPU) > hard)
+    {
+      printf ("%s: cpu limit of %lld ticks exceeded\n", t->name, hard);
+      printf ("%s: exit(%d)\n", t->name, -1);
+      thread_exit ();
+    }
+}
+
+/* Prints U, the resource usage of the process named NAME. */
+void
+usage_print (const char *name, const struct usage *u)
+{
+  printf ("%s: %lld user ticks, %lld kernel ticks, %lld syscalls, "
+          "%lld bytes read, %lld bytes written, %lld open files, "
+          "%lld pages\n",
+          name, u->user_ticks, u->kernel_ticks, u->syscalls,
+          u->bytes_read, u->bytes_written, u->open_files, u->pages);
+}
+
+/* Returns the amount of RESOURCE currently used according to U. */
+static int64_t
+usage_of (const struct usage *u, enum usage_resource resource)
+{
+  switch (resource)
+    {
+    case USAGE_CPU:
+      return u->user_ticks + u->kernel_ticks;
+    case USAGE_FILES:
+      return u->open_files;
+    case USAGE_PAGES:
+      return u->pages;
+    default:
+      NOT_REACHED ();
+    }
+}
+
+/* Prints a warning, the first time only, if U is over its soft
+   limit for RESOURCE. */
+static void
+warn_soft_limit (struct usage *u, enum usage_resource resource)
+{
+  int64_t soft = u->limits[resource].soft;
+
+  if (soft > 0 && usage_of (u, resource) > soft
+      && (u->warned & (1u << resource)) == 0)
+    {
+      u->warned |= 1u << resource;
+      printf ("%s: %s soft limit of %lld exceeded\n",
+              thread_name (), resource_names[resource], soft);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef USERPROG_USAGE_H
+#define USERPROG_USAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Resources whose use by a process can be limited. */
+enum usage_resource
+  {
+    USAGE_CPU,                  /* Timer ticks, user plus kernel. */
+    USAGE_FILES,                /* Open files. */
+    USAGE_PAGES,                /* Resident user pages. */
+    USAGE_CNT                   /* Number of resources. */
+  };
+
+/* Limits on one resource.  Going over the soft limit draws a
+   one-time warning; the hard limit cannot be exceeded.  Zero
+   means no limit. */
+struct usage_limit
+  {
+    int64_t soft;               /* Soft limit. */
+    int64_t hard;               /* Hard limit. */
+  };
+
+/* Resource usage of a user process, and its limits. */
+struct usage
+  {
+    int64_t user_ticks;         /* Timer ticks spent in user mode. */
+    int64_t kernel_ticks;       /* Timer ticks spent in the kernel. */
+    int64_t syscalls;           /* System calls issued. */
+    int64_t bytes_read;         /* Bytes read from files. */
+    int64_t bytes_written;      /* Bytes written to files. */
+    int64_t open_files;         /* Files currently open. */
+    int64_t pages;              /* User pages currently resident. */
+    struct usage_limit limits[USAGE_CNT];  /* Limits. */
+    unsigned warned;            /* Bit N set: warned about resource N. */
+  };
+
+/* If true, print each process's resource usage when it exits.
+   Controlled by kernel command-line option "-acct". */
+extern bool usage_report;
+
+bool usage_set_limit (char *spec);
+void usage_start (struct usage *);
+bool usage_tick (struct usage *, bool user);
+bool usage_charge (enum usage_resource, int64_t amount);
+void usage_uncharge (enum usage_resource, int64_t amount);
+void usage_check_cpu (void);
+void usage_print (const char *name, const struct usage *);
+
+#endif /* userprog/usage.h */